@@ -0,0 +1,74 @@
+#!/bin/sh
+#
+# bench.sh -- benchmark ical2html, icalfilter and icalmerge
+#
+# Run by "make bench" in the build directory. Generates synthetic
+# calendars with icalgen and prints one line of JSON per scenario (see
+# benchrun.c). The environment can change the size of the run:
+#
+#   BENCH_EVENTS  number of events per generated file (default 20000)
+#   BENCH_RUNS    times each scenario is run, the fastest counts (3)
+#   BENCH_DIR     directory for the generated files (bench.tmp)
+#
+# Created: 16 Oct 2026
+
+set -e
+
+N=${BENCH_EVENTS:-20000}
+RUNS=${BENCH_RUNS:-3}
+DIR=${BENCH_DIR:-bench.tmp}
+
+mkdir -p "$DIR"
+
+# The same seed for mixed and updated, so they have the same UIDs
+./icalgen -n "$N" -r 0 -s 1 "$DIR/plain.ics"
+./icalgen -n "$N" -r 1 -x 3 -o 0.1 -z 4 -s 2 "$DIR/recurring.ics"
+./icalgen -n "$N" -r 0.2 -x 2 -o 0.05 -c 16 -z 2 -s 3 "$DIR/mixed.ics"
+./icalgen -n "$N" -r 0.2 -x 2 -o 0.05 -c 16 -z 2 -s 3 -u 0.1 \
+  "$DIR/updated.ics"
+
+# Pairs in which every event of the second file replaces the first's
+./icalgen -n "$N" -r 0 -s 1 -u 1 "$DIR/plain-updated.ics"
+./icalgen -n "$((4 * N))" -r 0 -s 4 "$DIR/large.ics"
+./icalgen -n "$((4 * N))" -r 0 -s 4 -u 1 "$DIR/large-updated.ics"
+
+run() {
+  ./benchrun -n "$RUNS" "$@"
+}
+
+# parse: no event falls in the period, so almost all time is parsing
+run parse "$N" "$DIR/plain.ics" \
+  ./ical2html 20200101 P1D "$DIR/plain.ics"
+
+# expand: only recurring events, many instances before a short period
+run expand "$N" "$DIR/recurring.ics" \
+  ./ical2html 20261201 P1W "$DIR/recurring.ics"
+
+# sort: every event in the period, with as little to print as possible
+run sort "$N" "$DIR/plain.ics" \
+  ./ical2html 20260101 P53W "$DIR/plain.ics"
+
+# render: a year of mixed events with descriptions and locations
+run render "$N" "$DIR/mixed.ics" \
+  ./ical2html -d -l 20260101 P53W "$DIR/mixed.ics"
+
+# icalfilter: two categories, no private events
+run icalfilter "$N" "$DIR/mixed.ics" \
+  ./icalfilter -c cat1 -c cat3 -P PRIVATE "$DIR/mixed.ics" "$DIR/filtered.ics"
+
+# icalmerge: two versions of the same calendar, 10% of the events newer
+run icalmerge "$((2 * N))" "$DIR/mixed.ics,$DIR/updated.ics" \
+  ./icalmerge "$DIR/mixed.ics" "$DIR/updated.ics" "$DIR/merged.ics"
+
+# icalmerge_replace: every event replaced, at N and at 4N events, with
+# and without -s. The events per second of the 4x runs should be about
+# those of the others; if a replacement cost time in proportion to the
+# events kept so far, they would be four times lower.
+for s in "" -s; do
+  run "icalmerge_replace${s:+_stream}" "$((2 * N))" \
+    "$DIR/plain.ics,$DIR/plain-updated.ics" \
+    ./icalmerge $s "$DIR/plain.ics" "$DIR/plain-updated.ics" "$DIR/merged.ics"
+  run "icalmerge_replace_4x${s:+_stream}" "$((8 * N))" \
+    "$DIR/large.ics,$DIR/large-updated.ics" \
+    ./icalmerge $s "$DIR/large.ics" "$DIR/large-updated.ics" "$DIR/merged.ics"
+done
@@ -0,0 +1,150 @@
+/*
+ * benchrun -- run a command a few times, print its speed as JSON
+ *
+ * Prints one line, e.g.,
+ *
+ *     {"scenario":"parse","events":10000,"bytes":4123456,"runs":3,
+ *      "wall_s":0.412,"cpu_s":0.405,"events_per_s":24271.8,
+ *      "mb_per_s":9.545,"max_rss_kb":53124}
+ *
+ * (without the line break) with the fastest of the runs and the
+ * largest peak resident set size of any run. The command's standard
+ * output goes to /dev/null.
+ *
+ * Created: 16 Oct 2026
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#define ERR_OUT_OF_MEM 1	/* Program exit codes */
+#define ERR_USAGE 2
+#define ERR_FILEIO 5
+#define ERR_COMMAND 8		/* The command failed */
+
+#define USAGE "Usage: benchrun [-n RUNS] scenario events input command...\n\
+  -n, --runs=N                 run the command N times (default 3)\n\
+  scenario is a name for the report, events the number of events in\n\
+  input, which is only used for its size and may be several files\n\
+  separated by commas; command is run as given\n"
+
+/* Long command line options */
+static struct option options[] = {
+  {"runs", 1, 0, 'n'},
+  {0, 0, 0, 0}
+};
+
+#define OPTIONS "+n:"
+
+
+/* fatal -- print error message and exit with errcode */
+static void fatal(int errcode, const char *message,...)
+{
+  va_list args;
+  va_start(args, message);
+  vfprintf(stderr, message, args);
+  va_end(args);
+  exit(errcode);
+}
+
+
+/* total_size -- the sum of the sizes of a comma-separated list of files */
+static long total_size(const char *list)
+{
+  char *copy, *path, *next;
+  struct stat st;
+  long size = 0;
+
+  if (!(copy = strdup(list))) fatal(ERR_OUT_OF_MEM, "Out of memory\n");
+  for (path = copy; path; path = next) {
+    if ((next = strchr(path, ','))) *next++ = '\0';
+    if (stat(path, &st) != 0)
+      fatal(ERR_FILEIO, "%s: %s\n", path, strerror(errno));
+    size += st.st_size;
+  }
+  free(copy);
+  return size;
+}
+
+
+/* seconds -- a timeval as seconds */
+static double seconds(const struct timeval t)
+{
+  return t.tv_sec + t.tv_usec / 1e6;
+}
+
+
+/* run -- run the command once, return its wall and CPU time and RSS */
+static void run(char *argv[], double *wall, double *cpu, long *rss)
+{
+  struct timeval t0, t1;
+  struct rusage ru;
+  int status, fd;
+  pid_t pid;
+
+  gettimeofday(&t0, NULL);
+  if ((pid = fork()) < 0) fatal(ERR_COMMAND, "fork: %s\n", strerror(errno));
+  if (pid == 0) {
+    if ((fd = open("/dev/null", O_WRONLY)) >= 0) dup2(fd, 1);
+    execvp(argv[0], argv);
+    fprintf(stderr, "%s: %s\n", argv[0], strerror(errno));
+    _exit(127);
+  }
+  while (wait4(pid, &status, 0, &ru) < 0)
+    if (errno != EINTR) fatal(ERR_COMMAND, "wait4: %s\n", strerror(errno));
+  gettimeofday(&t1, NULL);
+
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    fatal(ERR_COMMAND, "%s failed\n", argv[0]);
+  *wall = seconds(t1) - seconds(t0);
+  *cpu = seconds(ru.ru_utime) + seconds(ru.ru_stime);
+  *rss = ru.ru_maxrss;		/* Kilobytes on Linux and the BSDs */
+}
+
+
+/* main */
+int main(int argc, char *argv[])
+{
+  double wall, cpu, best_wall = 0.0, best_cpu = 0.0;
+  long events, bytes, rss, max_rss = 0;
+  int c, runs = 3, i;
+  const char *scenario;
+
+  /* Read commandline, options end at the scenario name */
+  while ((c = getopt_long(argc, argv, OPTIONS, options, NULL)) != -1) {
+    switch (c) {
+    case 'n': runs = atoi(optarg); break;
+    default: fatal(ERR_USAGE, USAGE);
+    }
+  }
+  if (runs < 1 || optind > argc - 4) fatal(ERR_USAGE, USAGE);
+  scenario = argv[optind];
+  events = atol(argv[optind + 1]);
+  bytes = total_size(argv[optind + 2]);
+
+  for (i = 0; i < runs; i++) {
+    run(argv + optind + 3, &wall, &cpu, &rss);
+    if (i == 0 || wall < best_wall) {best_wall = wall; best_cpu = cpu;}
+    if (rss > max_rss) max_rss = rss;
+  }
+
+  printf("{\"scenario\":\"%s\",\"events\":%ld,\"bytes\":%ld,\"runs\":%d,"
+	 "\"wall_s\":%.4f,\"cpu_s\":%.4f,\"events_per_s\":%.1f,"
+	 "\"mb_per_s\":%.3f,\"max_rss_kb\":%ld}\n", scenario, events,
+	 bytes, runs, best_wall, best_cpu,
+	 best_wall > 0 ? events / best_wall : 0.0,
+	 best_wall > 0 ? bytes / best_wall / 1e6 : 0.0, max_rss);
+  return 0;
+}
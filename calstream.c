@@ -0,0 +1,281 @@
+/*
+ * calstream -- read the components of an iCalendar file one by one
+ *
+ * In streaming mode, the lines that make up the top-level components
+ * of the VCALENDAR (VTIMEZONE, VEVENT, etc.) are fed to the parser one
+ * component at a time, so at any moment only the component being
+ * parsed, the VTIMEZONEs and whatever the handler decided to keep are
+ * in memory.
+ *
+ * Regular files are mapped into memory and split into (unfolded)
+ * lines here, instead of going through fgets() and the parser's own
+ * line buffer. Pipes and terminals are read with stdio.
+ *
+ * Created: 16 Oct 2026
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#ifdef HAVE_MMAP
+#  include <sys/types.h>
+#  include <sys/stat.h>
+#  include <sys/mman.h>
+#endif
+#include <libical/ical.h>
+#include "calstream.h"
+
+/* Where the lines come from */
+typedef struct _source {
+  icalparser *parser;		/* Parser, also reads lines from stdio */
+  char *line;			/* Last line returned by next_line() */
+  const char *p, *end;		/* Mapped file: unread part */
+  size_t size;			/* Mapped file: allocated size of line */
+} source;
+
+
+/* read_stream -- read size bytes into s from stream d */
+static char* read_stream(char *s, size_t size, void *d)
+{
+  return fgets(s, size, (FILE*)d);
+}
+
+
+/* next_mapped_line -- copy next unfolded line from the mapped file */
+static char *next_mapped_line(source *src)
+{
+  const char *nl;
+  size_t len = 0, n;
+  char *h;
+
+  if (src->p == src->end) return NULL;
+
+  for (;;) {
+    /* Find the end of this physical line */
+    nl = memchr(src->p, '\n', src->end - src->p);
+    n = (nl ? nl : src->end) - src->p;
+    if (n > 0 && src->p[n-1] == '\r') n--;
+
+    /* Append it to the logical line */
+    if (len + n + 1 > src->size) {
+      src->size = 2 * (len + n + 1);
+      if (! (h = realloc(src->line, src->size))) {
+	fprintf(stderr, "Out of memory\n");
+	exit(1);
+      }
+      src->line = h;
+    }
+    memcpy(src->line + len, src->p, n);
+    len += n;
+    src->p = nl ? nl + 1 : src->end;
+
+    /* A line that starts with a space or tab continues this one */
+    if (src->p == src->end || (*src->p != ' ' && *src->p != '\t')) break;
+    src->p++;
+  }
+
+  /* Remove trailing white space, like icalparser_get_line() does */
+  while (len > 0 && (src->line[len-1] == ' ' || src->line[len-1] == '\t'))
+    len--;
+  src->line[len] = '\0';
+  return src->line;
+}
+
+
+/* next_line -- return the next unfolded line, or NULL at end of input */
+static char *next_line(source *src)
+{
+  if (src->p) return next_mapped_line(src);
+
+  /* Read through the parser, free the previous line first */
+  if (src->line) icalmemory_free_buffer(src->line);
+  src->line = icalparser_get_line(src->parser, read_stream);
+  return src->line;
+}
+
+
+/* is_line -- check if line is keyword (BEGIN or END) followed by name */
+static int is_line(const char *line, const char *keyword, const char *name)
+{
+  size_t n = strlen(keyword);
+
+  if (strncasecmp(line, keyword, n) != 0 || line[n] != ':') return 0;
+  return name == NULL || strcasecmp(line + n + 1, name) == 0;
+}
+
+
+/* dispatch -- pass comp to the handler, add it to calendar if kept
+ *
+ * While the handler runs, comp's parent is calendar, so that TZIDs can
+ * be resolved, but it isn't in calendar's list of components yet:
+ * taking it out of that list again would mean a search past all the
+ * components kept so far. VTIMEZONEs are added right away. An event
+ * the handler takes keeps calendar as its parent, but isn't added. */
+static void dispatch(icalcomponent *calendar, icalcomponent *comp,
+		     calstream_handler handler, void *data)
+{
+  icalcomponent_kind kind = icalcomponent_isa(comp);
+  int keep;
+
+  if (kind == ICAL_VTIMEZONE_COMPONENT) {
+    icalcomponent_add_component(calendar, comp);
+    (void) handler(comp, data);
+    return;
+  }
+  if (kind != ICAL_VEVENT_COMPONENT) {
+    icalcomponent_free(comp);	/* Not interested in VTODO, etc. */
+    return;
+  }
+
+  icalcomponent_set_parent(comp, calendar);
+  keep = handler(comp, data);
+  if (keep == CALSTREAM_TAKE) return;	/* Handler frees it */
+  icalcomponent_set_parent(comp, NULL);
+  if (keep == CALSTREAM_FREE) icalcomponent_free(comp);
+  else icalcomponent_add_component(calendar, comp);
+}
+
+
+/* calstream_release -- free a VEVENT that a handler has taken */
+void calstream_release(icalcomponent *comp)
+{
+  /* icalcomponent_free() ignores components that have a parent */
+  icalcomponent_set_parent(comp, NULL);
+  icalcomponent_free(comp);
+}
+
+
+/* parse_streaming -- feed one component at a time to the parser */
+static icalcomponent *parse_streaming(source *src,
+				      calstream_handler handler, void *data)
+{
+  icalcomponent *calendar, *c;
+  int in_component = 0, seen = 0;
+  char *line;
+
+  calendar = icalcomponent_new(ICAL_VCALENDAR_COMPONENT);
+
+  while ((line = next_line(src))) {
+
+    if (!in_component) {
+      if (is_line(line, "BEGIN", "VCALENDAR") || !is_line(line, "BEGIN", NULL)) {
+	/* Skip the VCALENDAR wrapper and its properties */
+	if (is_line(line, "BEGIN", NULL)) seen = 1;
+	continue;
+      }
+      in_component = 1;		/* Start of a VEVENT, VTIMEZONE, etc. */
+      seen = 1;
+    }
+
+    /* Parser returns the component when its END line has been added */
+    if ((c = icalparser_add_line(src->parser, line))) {
+      in_component = 0;
+      dispatch(calendar, c, handler, data);
+    }
+  }
+
+  /* If the input ended in the middle of a component, use what we have */
+  if (in_component && (c = icalparser_clean(src->parser)))
+    dispatch(calendar, c, handler, data);
+
+  if (!seen) {icalcomponent_free(calendar); return NULL;}
+  return calendar;
+}
+
+
+/* parse_all -- parse all lines, return the root component */
+static icalcomponent *parse_all(source *src)
+{
+  icalcomponent *root = NULL, *c, *x;
+  char *line;
+
+  /* Same as icalparser_parse(), but with our own lines */
+  while ((line = next_line(src))) {
+    if (! (c = icalparser_add_line(src->parser, line))) continue;
+    if (!root) {
+      root = c;			/* Just one component */
+    } else if (icalcomponent_isa(root) != ICAL_XROOT_COMPONENT) {
+      x = icalcomponent_new(ICAL_XROOT_COMPONENT); /* Got a second one */
+      icalcomponent_add_component(x, root);
+      icalcomponent_add_component(x, c);
+      root = x;
+    } else {
+      icalcomponent_add_component(root, c);
+    }
+  }
+  return root;
+}
+
+
+/* parse_whole -- parse the whole stream and then call the handler */
+static icalcomponent *parse_whole(source *src,
+				  calstream_handler handler, void *data)
+{
+  icalcomponent *comp, *h, *next;
+
+  /* Let the parser read the file and return all components */
+  if (src->p) comp = parse_all(src);
+  else comp = icalparser_parse(src->parser, read_stream);
+  if (!comp) return NULL;
+
+  /* First the VTIMEZONEs, then the VEVENTs */
+  for (h = icalcomponent_get_first_component(comp, ICAL_VTIMEZONE_COMPONENT);
+       h; h = icalcomponent_get_next_component(comp, ICAL_VTIMEZONE_COMPONENT))
+    (void) handler(h, data);
+
+  for (h = icalcomponent_get_first_component(comp, ICAL_VEVENT_COMPONENT);
+       h; h = next) {
+    next = icalcomponent_get_next_component(comp, ICAL_VEVENT_COMPONENT);
+    (void) handler(h, data);	/* Unneeded ones are freed with comp */
+  }
+
+  return comp;
+}
+
+
+/* calstream_parse -- parse stream, call handler for each component */
+icalcomponent *calstream_parse(FILE *stream, int streaming,
+			       calstream_handler handler, void *data)
+{
+  icalcomponent *comp;
+  source src = {NULL, NULL, NULL, NULL, 0};
+#ifdef HAVE_MMAP
+  void *map = NULL;
+  size_t maplen = 0;
+  struct stat st;
+
+  /* Map regular files into memory, read anything else with stdio */
+  if (fstat(fileno(stream), &st) == 0 && S_ISREG(st.st_mode)
+      && st.st_size > 0 && ftell(stream) == 0) {
+    maplen = st.st_size;
+    map = mmap(NULL, maplen, PROT_READ, MAP_PRIVATE, fileno(stream), 0);
+    if (map == MAP_FAILED) {
+      map = NULL;
+    } else {
+#ifdef MADV_SEQUENTIAL
+      (void) madvise(map, maplen, MADV_SEQUENTIAL);
+#endif
+      src.p = map;
+      src.end = src.p + maplen;
+    }
+  }
+#endif
+
+  /* Create a new parser object and tell it what input stream to use */
+  src.parser = icalparser_new();
+  icalparser_set_gen_data(src.parser, stream);
+
+  if (streaming) comp = parse_streaming(&src, handler, data);
+  else comp = parse_whole(&src, handler, data);
+
+  /* Clean up */
+  if (src.end) free(src.line);
+  else if (src.line) icalmemory_free_buffer(src.line);
+#ifdef HAVE_MMAP
+  if (map) munmap(map, maplen);
+#endif
+  icalparser_free(src.parser);
+  return comp;
+}
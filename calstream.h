@@ -0,0 +1,49 @@
+/*
+ * calstream -- read the components of an iCalendar file one by one
+ *
+ * Created: 16 Oct 2026
+ */
+
+#ifndef CALSTREAM_H
+#define CALSTREAM_H
+
+#include <stdio.h>
+#include <libical/ical.h>
+
+/* Return values of a calstream_handler */
+#define CALSTREAM_FREE 0	/* Handler doesn't need the component anymore */
+#define CALSTREAM_KEEP 1	/* Handler keeps the component */
+#define CALSTREAM_TAKE 2	/* Handler owns the component, see below */
+
+/* Called for every VTIMEZONE and VEVENT, with the data passed to
+ * calstream_parse(). The component's parent is the VCALENDAR that
+ * calstream_parse() returns. In streaming mode a VEVENT is only added
+ * to that VCALENDAR's components if the handler keeps it, so the
+ * handler must not remove it from there. The return value is ignored
+ * for VTIMEZONEs, which always stay.
+ *
+ * A VEVENT the handler takes in streaming mode isn't added to the
+ * VCALENDAR, but still has it as its parent, for its TZIDs. The
+ * handler frees it with calstream_release() when it is done with it,
+ * which costs nothing like removing a component from the VCALENDAR. */
+typedef int (*calstream_handler)(icalcomponent *comp, void *data);
+
+/* calstream_parse -- parse stream, call handler for each component
+ *
+ * If streaming is 0, the whole file is parsed first and the handler is
+ * called for all VTIMEZONEs and then all VEVENTs, which all stay in
+ * the VCALENDAR, whatever the handler returns. Otherwise each
+ * component is passed to the handler as soon as it has been read and
+ * components the handler doesn't keep are freed immediately. In that
+ * case VTIMEZONEs must precede the events that refer to them.
+ *
+ * Returns the VCALENDAR that holds the remaining components (the
+ * caller must free it), or NULL if the stream contained no iCalendar
+ * data. */
+extern icalcomponent *calstream_parse(FILE *stream, int streaming,
+				      calstream_handler handler, void *data);
+
+/* calstream_release -- free a VEVENT that a handler has taken */
+extern void calstream_release(icalcomponent *comp);
+
+#endif /* CALSTREAM_H */
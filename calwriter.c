@@ -0,0 +1,112 @@
+/*
+ * calwriter -- write a VCALENDAR one component at a time
+ *
+ * Created: 16 Oct 2026
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <libical/ical.h>
+#include "outbuf.h"
+#include "calwriter.h"
+
+
+/* calwriter_open -- start a VCALENDAR with the given PRODID */
+int calwriter_open(calwriter *w, const char *path, const char *prodid)
+{
+  icalcomponent *cal;
+  const char *s, *end;
+  mode_t mask;
+  int fd, e;
+
+  memset(w, 0, sizeof(*w));
+  if (!(w->path = strdup(path))
+      || !(w->tmp = malloc(strlen(path) + 8))
+      || !(w->out = malloc(sizeof(*w->out))))
+    goto failed;
+
+  /* Let libical write an empty VCALENDAR, so that the header and the
+   * footer are formatted (and end lines) like the components */
+  cal = icalcomponent_vanew(ICAL_VCALENDAR_COMPONENT,
+			    icalproperty_new_version("2.0"),
+			    icalproperty_new_prodid(prodid),
+			    0);
+  s = icalcomponent_as_ical_string(cal);
+  if (!s || !(end = strstr(s, "END:VCALENDAR")) || !(w->footer = strdup(end))) {
+    icalcomponent_free(cal);
+    errno = ENOMEM;
+    goto failed;
+  }
+
+  /* Write to a temporary file with the usual permissions */
+  sprintf(w->tmp, "%s.XXXXXX", path);
+  if ((fd = mkstemp(w->tmp)) < 0) {icalcomponent_free(cal); goto failed;}
+  mask = umask(0);
+  umask(mask);
+  (void) fchmod(fd, 0666 & ~mask);
+
+  outbuf_init(w->out, fd);
+  outbuf_write(w->out, s, end - s);
+  icalcomponent_free(cal);
+  return 0;
+
+ failed:
+  e = errno;
+  free(w->path);
+  free(w->tmp);
+  free(w->footer);
+  free(w->out);
+  memset(w, 0, sizeof(*w));
+  errno = e;
+  return -1;
+}
+
+
+/* calwriter_add -- write a component (VTIMEZONE, VEVENT, etc.) */
+void calwriter_add(calwriter *w, icalcomponent *comp)
+{
+  const char *s = icalcomponent_as_ical_string(comp);
+
+  if (s) outbuf_puts(w->out, s);
+}
+
+
+/* calwriter_copy -- write n bytes of already serialized components */
+void calwriter_copy(calwriter *w, const char *s, size_t n)
+{
+  outbuf_write(w->out, s, n);
+}
+
+
+/* calwriter_tell -- number of bytes written so far, the next offset */
+unsigned long calwriter_tell(const calwriter *w)
+{
+  return w->out->written + w->out->len;
+}
+
+
+/* calwriter_close -- finish the VCALENDAR and rename it to its path */
+int calwriter_close(calwriter *w)
+{
+  int r = 0, e = 0;
+
+  outbuf_puts(w->out, w->footer);
+  if (outbuf_flush(w->out) != 0) {r = -1; e = errno;}
+  if (close(w->out->fd) != 0 && r == 0) {r = -1; e = errno;}
+  if (r == 0 && rename(w->tmp, w->path) != 0) {r = -1; e = errno;}
+  if (r != 0) (void) unlink(w->tmp);
+
+  free(w->path);
+  free(w->tmp);
+  free(w->footer);
+  free(w->out);
+  memset(w, 0, sizeof(*w));
+  errno = e;
+  return r;
+}
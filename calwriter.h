@@ -0,0 +1,46 @@
+/*
+ * calwriter -- write a VCALENDAR one component at a time
+ *
+ * Instead of building a complete VCALENDAR in memory and serializing
+ * it at the end, the header is written when the file is opened, each
+ * component as soon as it is added and the footer when it is closed.
+ * The output goes to a temporary file that replaces the real one only
+ * when everything has been written.
+ *
+ * Created: 16 Oct 2026
+ */
+
+#ifndef CALWRITER_H
+#define CALWRITER_H
+
+#include <libical/ical.h>
+#include "outbuf.h"
+
+typedef struct _calwriter {
+  char *path;			/* The file to write */
+  char *tmp;			/* The temporary file while writing */
+  char *footer;			/* END:VCALENDAR, as libical writes it */
+  outbuf *out;
+} calwriter;
+
+/* calwriter_open -- start a VCALENDAR with the given PRODID
+ *
+ * Returns 0, or -1 with errno set if the file cannot be created. */
+extern int calwriter_open(calwriter *w, const char *path, const char *prodid);
+
+/* calwriter_add -- write a component (VTIMEZONE, VEVENT, etc.) */
+extern void calwriter_add(calwriter *w, icalcomponent *comp);
+
+/* calwriter_copy -- write n bytes of already serialized components */
+extern void calwriter_copy(calwriter *w, const char *s, size_t n);
+
+/* calwriter_tell -- number of bytes written so far, the next offset */
+extern unsigned long calwriter_tell(const calwriter *w);
+
+/* calwriter_close -- finish the VCALENDAR and rename it to its path
+ *
+ * Returns 0, or -1 with errno set if any write failed, in which case
+ * the temporary file is removed and the old file left alone. */
+extern int calwriter_close(calwriter *w);
+
+#endif /* CALWRITER_H */
@@ -0,0 +1,337 @@
+/*
+ * eventq -- growable queue of event occurrences
+ *
+ * Created: 16 Oct 2026
+ */
+
+#include "config.h"
+#include <stdlib.h>
+#include <string.h>
+#include "eventq.h"
+
+#define MIN_SIZE 64		/* Smallest number of items to allocate */
+#define RADIX_MIN 512		/* Buckets this big are radix sorted */
+
+/* A UID and its index in the queue's uids[], for rank_uids() */
+typedef struct _uid_ref {
+  const char *uid;
+  int index;
+} uid_ref;
+
+/* What the radix sort moves around */
+typedef struct _sort_key {
+  unsigned long long key;	/* Current key, minus its minimum */
+  int index;			/* Index of the item in the bucket */
+} sort_key;
+
+
+/* eventq_init -- initialize an empty queue */
+void eventq_init(event_queue *q)
+{
+  q->items = NULL;
+  q->n = 0;
+  q->size = 0;
+  q->uids = NULL;
+  q->nuids = 0;
+  q->uidsize = 0;
+}
+
+
+/* eventq_reserve -- make room for at least n items, return 0 or -1 */
+int eventq_reserve(event_queue *q, int n)
+{
+  event_item *h;
+
+  if (n < MIN_SIZE) n = MIN_SIZE;
+  if (n <= q->size) return 0;
+  if (! (h = realloc(q->items, n * sizeof(*h)))) return -1;
+  q->items = h;
+  q->size = n;
+  return 0;
+}
+
+
+/* eventq_append -- return a new, uninitialized item, or NULL if no memory */
+event_item *eventq_append(event_queue *q)
+{
+  if (q->n == q->size && eventq_reserve(q, 2 * q->size) != 0) return NULL;
+  return &q->items[q->n++];
+}
+
+
+/* eventq_day_number -- number of days since 1 Jan 1970 */
+long eventq_day_number(int year, int month, int day)
+{
+  long y = month <= 2 ? year - 1 : year;
+  long era = (y >= 0 ? y : y - 399) / 400;
+  long yoe = y - era * 400;				/* [0, 399] */
+  long doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+  long doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;	/* [0, 146096] */
+
+  return era * 146097 + doe - 719468;
+}
+
+
+/* eventq_time_key -- seconds since 1970 of a UTC time, or EVENTQ_NULL_KEY */
+long long eventq_time_key(const struct icaltimetype t)
+{
+  if (icaltime_is_null_time(t)) return EVENTQ_NULL_KEY;
+  return eventq_day_number(t.year, t.month, t.day) * 86400LL
+    + t.hour * 3600 + t.minute * 60 + t.second;
+}
+
+
+/* eventq_key_time -- the UTC time of a key from eventq_time_key() */
+struct icaltimetype eventq_key_time(long long key)
+{
+  struct icaltimetype t = icaltime_null_time();
+  long long days, secs;
+  long z, era, doe, yoe, doy, mp;
+
+  if (key == EVENTQ_NULL_KEY) return t;
+  days = key / 86400;
+  if ((secs = key % 86400) < 0) {secs += 86400; days--;}
+
+  /* The inverse of eventq_day_number() */
+  z = days + 719468;
+  era = (z >= 0 ? z : z - 146096) / 146097;
+  doe = z - era * 146097;				/* [0, 146096] */
+  yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365; /* [0, 399] */
+  doy = doe - (365 * yoe + yoe / 4 - yoe / 100);	/* [0, 365] */
+  mp = (5 * doy + 2) / 153;				/* [0, 11] */
+  t.day = doy - (153 * mp + 2) / 5 + 1;
+  t.month = mp < 10 ? mp + 3 : mp - 9;
+  t.year = yoe + era * 400 + (t.month <= 2);
+  t.hour = secs / 3600;
+  t.minute = secs / 60 % 60;
+  t.second = secs % 60;
+  return t;
+}
+
+
+/* eventq_uid_key -- number for uid, or -1 if out of memory */
+int eventq_uid_key(event_queue *q, const char *uid)
+{
+  const char **h;
+
+  if (q->nuids && q->uids[q->nuids - 1] == uid) return q->nuids - 1;
+  if (q->nuids == q->uidsize) {
+    if (! (h = realloc(q->uids, 2 * (q->uidsize + 16) * sizeof(*h))))
+      return -1;
+    q->uids = h;
+    q->uidsize = 2 * (q->uidsize + 16);
+  }
+  q->uids[q->nuids] = uid;
+  return q->nuids++;
+}
+
+
+/* eventq_append_queue -- append copies of the items of from, 0 or -1 */
+int eventq_append_queue(event_queue *q, const event_queue *from)
+{
+  event_item *item;
+  int i;
+
+  if (eventq_reserve(q, q->n + from->n) != 0) return -1;
+  for (i = 0; i < from->n; i++) {
+    item = eventq_append(q);
+    *item = from->items[i];
+    if ((item->uid_key = eventq_uid_key(q, item->uid)) < 0) return -1;
+  }
+  return 0;
+}
+
+
+/* eventq_compare -- compare two event_items by their keys (for qsort) */
+int eventq_compare(const void *aa, const void *bb)
+{
+  const event_item *a = (const event_item *)aa;
+  const event_item *b = (const event_item *)bb;
+
+  if (a->start_key != b->start_key) return a->start_key < b->start_key ? -1 : 1;
+  if (a->end_key != b->end_key) return a->end_key < b->end_key ? -1 : 1;
+  if (a->uid_key != b->uid_key) return a->uid_key < b->uid_key ? -1 : 1;
+  if (a->recur_key != b->recur_key) return a->recur_key < b->recur_key ? -1 : 1;
+  if (a->seq != b->seq) return a->seq < b->seq ? -1 : 1;
+  return 0;
+}
+
+
+/* compare_uids -- compare two uid_refs by string (for qsort) */
+static int compare_uids(const void *a, const void *b)
+{
+  return strcmp(((const uid_ref *)a)->uid, ((const uid_ref *)b)->uid);
+}
+
+
+/* rank_uids -- replace uid_keys by ranks in strcmp() order, 0 or -1 */
+static int rank_uids(event_queue *q)
+{
+  uid_ref *order;
+  int *rank, i, r;
+
+  if (! (order = malloc((q->nuids + 1) * sizeof(*order)))) return -1;
+  if (! (rank = malloc((q->nuids + 1) * sizeof(*rank)))) {
+    free(order);
+    return -1;
+  }
+
+  /* Sort the distinct UIDs, equal strings get equal ranks */
+  for (i = 0; i < q->nuids; i++) {
+    order[i].uid = q->uids[i];
+    order[i].index = i;
+  }
+  qsort(order, q->nuids, sizeof(*order), compare_uids);
+  for (r = i = 0; i < q->nuids; i++) {
+    if (i > 0 && strcmp(order[i].uid, order[i-1].uid) != 0) r++;
+    rank[order[i].index] = r;
+  }
+
+  for (i = 0; i < q->n; i++) q->items[i].uid_key = rank[q->items[i].uid_key];
+  q->nuids = 0;			/* The ranks are not indexes anymore */
+
+  free(rank);
+  free(order);
+  return 0;
+}
+
+
+/* radix_pass -- stable sort of keys on the byte at shift */
+static void radix_pass(sort_key *from, sort_key *to, int n, int shift)
+{
+  int count[257], i;
+
+  memset(count, 0, sizeof(count));
+  for (i = 0; i < n; i++) count[((from[i].key >> shift) & 0xff) + 1]++;
+  for (i = 0; i < 256; i++) count[i + 1] += count[i];
+  for (i = 0; i < n; i++) to[count[(from[i].key >> shift) & 0xff]++] = from[i];
+}
+
+
+/* Fields of an event_item to sort on, least significant first */
+enum {SEQ_KEY, RECUR_KEY, UID_KEY, END_KEY, START_KEY};
+
+/* sort_field -- return one of the sort keys of an item */
+static long long sort_field(const event_item *e, int field)
+{
+  switch (field) {
+  case SEQ_KEY: return e->seq;
+  case RECUR_KEY: return e->recur_key;
+  case UID_KEY: return e->uid_key;
+  case END_KEY: return e->end_key;
+  default: return e->start_key;
+  }
+}
+
+
+/* radix_field -- stable sort of keys on one field of the items */
+static void radix_field(const event_item *a, sort_key **keys, sort_key **tmp,
+			int n, int field)
+{
+  unsigned long long range;
+  long long v, min, max;
+  sort_key *h;
+  int i, shift;
+
+  /* Only sort on the bytes that differ within the bucket */
+  min = max = sort_field(&a[(*keys)[0].index], field);
+  for (i = 1; i < n; i++) {
+    v = sort_field(&a[(*keys)[i].index], field);
+    if (v < min) min = v;
+    if (v > max) max = v;
+  }
+  for (i = 0; i < n; i++)
+    (*keys)[i].key = (unsigned long long)sort_field(&a[(*keys)[i].index], field)
+      - (unsigned long long)min;
+  range = (unsigned long long)max - (unsigned long long)min;
+
+  for (shift = 0; shift < 64 && range >> shift; shift += 8) {
+    radix_pass(*keys, *tmp, n, shift);
+    h = *keys; *keys = *tmp; *tmp = h;
+  }
+}
+
+
+/* radix_sort -- sort n items in the same order as eventq_compare() */
+static int radix_sort(event_item *a, int n)
+{
+  sort_key *keys, *tmp;
+  event_item *copy;
+  int i, field;
+
+  keys = malloc(n * sizeof(*keys));
+  tmp = malloc(n * sizeof(*tmp));
+  copy = malloc(n * sizeof(*copy));
+  if (!keys || !tmp || !copy) {free(keys); free(tmp); free(copy); return -1;}
+
+  /* Least significant field first, each pass is stable */
+  for (i = 0; i < n; i++) keys[i].index = i;
+  for (field = SEQ_KEY; field <= START_KEY; field++)
+    radix_field(a, &keys, &tmp, n, field);
+
+  /* Put the items in the order of keys */
+  memcpy(copy, a, n * sizeof(*copy));
+  for (i = 0; i < n; i++) a[i] = copy[keys[i].index];
+
+  free(copy);
+  free(tmp);
+  free(keys);
+  return 0;
+}
+
+
+/* eventq_sort_by_day -- put items in day buckets, sort each bucket */
+int *eventq_sort_by_day(event_queue *q, long day0, int ndays)
+{
+  event_item *sorted;
+  int *first, *day, i, d, n;
+
+  if (rank_uids(q) != 0) return NULL;
+  if (! (first = calloc(ndays + 1, sizeof(*first)))) return NULL;
+  if (! (day = malloc((q->n + 1) * sizeof(*day)))) {free(first); return NULL;}
+
+  /* Count the items on each day (a counting sort) */
+  for (i = 0; i < q->n; i++) {
+    day[i] = eventq_day_number(q->items[i].start.year, q->items[i].start.month,
+			       q->items[i].start.day) - day0;
+    if (day[i] >= 0 && day[i] < ndays) first[day[i] + 1]++;
+  }
+  for (d = 0; d < ndays; d++) first[d + 1] += first[d];
+  n = first[ndays];
+
+  /* Move the items to their buckets */
+  if (! (sorted = malloc((n ? n : 1) * sizeof(*sorted)))) {
+    free(day);
+    free(first);
+    return NULL;
+  }
+  for (i = 0; i < q->n; i++)
+    if (day[i] >= 0 && day[i] < ndays) sorted[first[day[i]]++] = q->items[i];
+
+  /* The loop advanced each first[d] to the start of day d+1, undo that */
+  for (d = ndays; d > 0; d--) first[d] = first[d - 1];
+  first[0] = 0;
+
+  /* Sort each day */
+  for (d = 0; d < ndays; d++) {
+    n = first[d + 1] - first[d];
+    if (n >= RADIX_MIN && radix_sort(sorted + first[d], n) == 0) continue;
+    if (n > 1) qsort(sorted + first[d], n, sizeof(*sorted), eventq_compare);
+  }
+
+  free(day);
+  free(q->items);
+  q->items = sorted;
+  q->n = first[ndays];
+  q->size = q->n ? q->n : 1;
+  return first;
+}
+
+
+/* eventq_free -- free the memory used by the queue */
+void eventq_free(event_queue *q)
+{
+  free(q->uids);
+  free(q->items);
+  eventq_init(q);
+}
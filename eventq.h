@@ -0,0 +1,82 @@
+/*
+ * eventq -- growable queue of event occurrences
+ *
+ * Created: 16 Oct 2026
+ */
+
+#ifndef EVENTQ_H
+#define EVENTQ_H
+
+#include <libical/ical.h>
+
+#define EVENTQ_NULL_KEY (-0x7fffffffffffffffLL - 1) /* Key of a null time */
+
+/* Structure for storing applicable events */
+typedef struct _event_item {
+  struct icaltimetype start;
+  struct icaltimetype end;
+  const char *uid;
+  struct icaltimetype recur_time;
+  icalcomponent *event;
+  long long start_key;		/* Sort keys, see eventq_time_key() */
+  long long end_key;
+  long long recur_key;
+  int uid_key;			/* See eventq_uid_key() */
+  int seq;			/* Position of the event in the input */
+} event_item;
+
+/* A queue of event_items that grows geometrically */
+typedef struct _event_queue {
+  event_item *items;
+  int n;			/* Number of items in use */
+  int size;			/* Number of items allocated */
+  const char **uids;		/* Distinct UIDs, indexed by uid_key */
+  int nuids;
+  int uidsize;
+} event_queue;
+
+/* eventq_init -- initialize an empty queue */
+extern void eventq_init(event_queue *q);
+
+/* eventq_reserve -- make room for at least n items, return 0 or -1 */
+extern int eventq_reserve(event_queue *q, int n);
+
+/* eventq_append -- return a new, uninitialized item, or NULL if no memory */
+extern event_item *eventq_append(event_queue *q);
+
+/* eventq_day_number -- number of days since 1 Jan 1970 */
+extern long eventq_day_number(int year, int month, int day);
+
+/* eventq_time_key -- seconds since 1970 of a UTC time, or EVENTQ_NULL_KEY */
+extern long long eventq_time_key(const struct icaltimetype t);
+
+/* eventq_key_time -- the UTC time of a key from eventq_time_key() */
+extern struct icaltimetype eventq_key_time(long long key);
+
+/* eventq_uid_key -- number for uid, or -1 if out of memory
+ *
+ * Items of one event share the same uid pointer, so this only adds a
+ * new entry when the pointer differs from the previous call. The
+ * numbers are replaced by ranks in strcmp() order when sorting. */
+extern int eventq_uid_key(event_queue *q, const char *uid);
+
+/* eventq_append_queue -- append copies of the items of from, 0 or -1 */
+extern int eventq_append_queue(event_queue *q, const event_queue *from);
+
+/* eventq_compare -- compare two event_items by their keys (for qsort) */
+extern int eventq_compare(const void *a, const void *b);
+
+/* eventq_sort_by_day -- put items in day buckets, sort each bucket
+ *
+ * Moves the items whose start is on one of the ndays days from day0
+ * (a day number) into per-day buckets and drops the others. Each
+ * bucket is sorted by eventq_compare(), large ones with a radix sort.
+ * Returns an array of ndays+1 indexes: the items of day d are
+ * items[first[d]] up to items[first[d+1]-1]. Returns NULL if out of
+ * memory. */
+extern int *eventq_sort_by_day(event_queue *q, long day0, int ndays);
+
+/* eventq_free -- free the memory used by the queue */
+extern void eventq_free(event_queue *q);
+
+#endif /* EVENTQ_H */
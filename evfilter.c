@@ -0,0 +1,255 @@
+/*
+ * evfilter -- select events by class, category, start and summary
+ *
+ * Created: 16 Oct 2026
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <libical/ical.h>
+#include "evfilter.h"
+
+#define MIN_SET_SIZE 16		/* Initial number of slots in a strset */
+
+
+/* fold_hash -- hash of s in lower case, also return its length */
+static unsigned long fold_hash(const char *s, size_t *len)
+{
+  unsigned long h = 2166136261UL;
+  const char *t;
+
+  for (t = s; *t; t++) h = (h ^ tolower((unsigned char)*t)) * 16777619UL;
+  *len = t - s;
+  return h;
+}
+
+
+/* fold_equal -- compare s, ignoring case, with folded string t */
+static int fold_equal(const char *s, const char *t)
+{
+  for (; *s && tolower((unsigned char)*s) == *t; s++, t++) ;
+  return !*s && !*t;
+}
+
+
+/* strset_has -- check if s (not yet folded) is in the set */
+static int strset_has(const strset *set, const char *s, unsigned long h,
+		      size_t len)
+{
+  size_t i;
+
+  if (set->n == 0 || len > set->maxlen) return 0;
+  for (i = h & (set->size - 1); set->slots[i]; i = (i + 1) & (set->size - 1))
+    if (fold_equal(s, set->slots[i])) return 1;
+  return 0;
+}
+
+
+/* strset_insert -- put a folded string in a slot, the set has room */
+static void strset_insert(strset *set, char *s)
+{
+  size_t i, len;
+
+  i = fold_hash(s, &len) & (set->size - 1);
+  while (set->slots[i]) i = (i + 1) & (set->size - 1);
+  set->slots[i] = s;
+  if (len > set->maxlen) set->maxlen = len;
+  set->n++;
+}
+
+
+/* strset_add -- add a copy of s in lower case to the set */
+static int strset_add(strset *set, const char *s)
+{
+  char **old = set->slots, *t;
+  size_t i, len, oldsize = set->size;
+  unsigned long h = fold_hash(s, &len);
+
+  if (strset_has(set, s, h, len)) return 0; /* Already there */
+
+  /* Keep the set at most half full */
+  if (2 * (set->n + 1) > set->size) {
+    set->size = set->size ? 2 * set->size : MIN_SET_SIZE;
+    if (!(set->slots = calloc(set->size, sizeof(*set->slots)))) {
+      set->slots = old;
+      set->size = oldsize;
+      return -1;
+    }
+    set->n = 0;
+    for (i = 0; i < oldsize; i++) if (old[i]) strset_insert(set, old[i]);
+    free(old);
+  }
+
+  if (!(t = malloc(len + 1))) return -1;
+  for (i = 0; i <= len; i++) t[i] = tolower((unsigned char)s[i]);
+  strset_insert(set, t);
+  return 0;
+}
+
+
+/* strset_free -- free the strings and the slots */
+static void strset_free(strset *set)
+{
+  size_t i;
+
+  for (i = 0; i < set->size; i++) free(set->slots[i]);
+  free(set->slots);
+  set->slots = NULL;
+  set->size = set->n = set->maxlen = 0;
+}
+
+
+/* contains -- check if s contains folded string t, ignoring case */
+static int contains(const char *s, const char *t)
+{
+  const char *u, *v;
+
+  for (; *s; s++) {
+    for (u = s, v = t; *v && tolower((unsigned char)*u) == *v; u++, v++) ;
+    if (!*v) return 1;
+  }
+  return !*t;
+}
+
+
+/* evfilter_init -- make a filter that accepts all events */
+void evfilter_init(evfilter *f, const char *noclass)
+{
+  memset(f, 0, sizeof(*f));
+  f->noclass = noclass;
+  f->after = f->before = icaltime_null_time();
+}
+
+
+/* add_summary -- add a string to look for in summaries */
+static int add_summary(evfilter *f, const char *s)
+{
+  char **h, *t;
+  size_t i, len = strlen(s);
+
+  if (!(h = realloc(f->summaries, (f->nsummaries + 1) * sizeof(*h))))
+    return -1;
+  f->summaries = h;
+  if (!(t = malloc(len + 1))) return -1;
+  for (i = 0; i <= len; i++) t[i] = tolower((unsigned char)s[i]);
+  f->summaries[f->nsummaries++] = t;
+  return 0;
+}
+
+
+/* evfilter_add -- add a condition */
+int evfilter_add(evfilter *f, evfilter_kind what, const char *value)
+{
+  struct icaltimetype t;
+  int y, m, d;
+
+  f->active = 1;
+  switch (what) {
+  case EVFILTER_CLASS: return strset_add(&f->classes, value);
+  case EVFILTER_NOT_CLASS: return strset_add(&f->notclasses, value);
+  case EVFILTER_CATEGORY: return strset_add(&f->categories, value);
+  case EVFILTER_NOT_CATEGORY: return strset_add(&f->notcategories, value);
+  case EVFILTER_SUMMARY: return add_summary(f, value);
+  case EVFILTER_AFTER:
+  case EVFILTER_BEFORE:
+    if (sscanf(value, "%04d%02d%02d", &y, &m, &d) < 3) return -1;
+    t = icaltime_from_string(value);
+    if (icaltime_is_null_time(t)) return -1;
+    if (what == EVFILTER_AFTER) f->after = t; else f->before = t;
+    return 0;
+  }
+  return -1;
+}
+
+
+/* evfilter_starts_in -- check if a start is within -A and -B */
+int evfilter_starts_in(const evfilter *f, const struct icaltimetype start)
+{
+  if (!icaltime_is_null_time(f->after)
+      && icaltime_compare(start, f->after) < 0) return 0;
+  if (!icaltime_is_null_time(f->before)
+      && icaltime_compare(start, f->before) >= 0) return 0;
+  return 1;
+}
+
+
+/* evfilter_match -- check if an event passes all conditions */
+int evfilter_match(const evfilter *f, icalcomponent *ev)
+{
+  const char *class = NULL, *summary = NULL, *s;
+  int has_category = 0, recurring = 0, i;
+  icalproperty *p;
+  unsigned long h;
+  size_t len;
+
+  if (!f->active) return 1;
+
+  /* Collect what we need in one pass over the properties */
+  for (p = icalcomponent_get_first_property(ev, ICAL_ANY_PROPERTY); p;
+       p = icalcomponent_get_next_property(ev, ICAL_ANY_PROPERTY)) {
+    switch (icalproperty_isa(p)) {
+    case ICAL_CATEGORIES_PROPERTY:
+      if (f->categories.n == 0 && f->notcategories.n == 0) break;
+      if (!(s = icalproperty_get_categories(p))) break;
+      h = fold_hash(s, &len);
+      if (strset_has(&f->notcategories, s, h, len)) return 0;
+      if (strset_has(&f->categories, s, h, len)) has_category = 1;
+      break;
+    case ICAL_CLASS_PROPERTY:
+      class = icalproperty_get_value_as_string(p);
+      break;
+    case ICAL_SUMMARY_PROPERTY:
+      summary = icalproperty_get_summary(p);
+      break;
+    case ICAL_RRULE_PROPERTY:
+    case ICAL_RDATE_PROPERTY:
+      recurring = 1;
+      break;
+    default:
+      break;
+    }
+  }
+  if (f->categories.n != 0 && !has_category) return 0;
+
+  /* Check the class (unless we accept all) */
+  if (f->classes.n != 0 || f->notclasses.n != 0) {
+    s = class ? class : f->noclass;
+    h = fold_hash(s, &len);
+    if (f->classes.n != 0 && !strset_has(&f->classes, s, h, len)) return 0;
+    if (strset_has(&f->notclasses, s, h, len)) return 0;
+  }
+
+  /* Check that one of the strings occurs in the summary */
+  if (f->nsummaries != 0) {
+    if (!summary) return 0;
+    for (i = 0; i < f->nsummaries && !contains(summary, f->summaries[i]); i++);
+    if (i == f->nsummaries) return 0;
+  }
+
+  /* Check the start (with its time zone, so not from the loop above).
+   * A recurring event may have instances in the range even if its
+   * DTSTART isn't, so it is up to the caller to check those. */
+  if (!recurring
+      && !evfilter_starts_in(f, icalcomponent_get_dtstart(ev))) return 0;
+
+  return 1;
+}
+
+
+/* evfilter_free -- free the memory used by a filter */
+void evfilter_free(evfilter *f)
+{
+  int i;
+
+  strset_free(&f->classes);
+  strset_free(&f->notclasses);
+  strset_free(&f->categories);
+  strset_free(&f->notcategories);
+  for (i = 0; i < f->nsummaries; i++) free(f->summaries[i]);
+  free(f->summaries);
+  f->summaries = NULL;
+  f->nsummaries = 0;
+}
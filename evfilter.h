@@ -0,0 +1,76 @@
+/*
+ * evfilter -- select events by class, category, start and summary
+ *
+ * A filter is built once from the command line options and then
+ * applied to many events. Classes and categories are kept in hash
+ * sets of case-folded strings, so the cost per event doesn't depend on
+ * how many of them the filter names, and each event's properties are
+ * looked at only once.
+ *
+ * Created: 16 Oct 2026
+ */
+
+#ifndef EVFILTER_H
+#define EVFILTER_H
+
+#include <stddef.h>
+#include <libical/ical.h>
+
+/* What evfilter_add() adds */
+typedef enum {
+  EVFILTER_CLASS,		/* Only events of this class */
+  EVFILTER_NOT_CLASS,		/* No events of this class */
+  EVFILTER_CATEGORY,		/* Only events with this category */
+  EVFILTER_NOT_CATEGORY,	/* No events with this category */
+  EVFILTER_AFTER,		/* Only events starting at or after this */
+  EVFILTER_BEFORE,		/* Only events starting before this */
+  EVFILTER_SUMMARY		/* Only events with this in their summary */
+} evfilter_kind;
+
+/* A set of case-folded strings */
+typedef struct _strset {
+  char **slots;			/* Open addressing, NULL is empty */
+  size_t size, n;		/* size is 0 or a power of 2 */
+  size_t maxlen;		/* Length of the longest string */
+} strset;
+
+typedef struct _evfilter {
+  strset classes, notclasses;
+  strset categories, notcategories;
+  const char *noclass;		/* Class of events without a CLASS */
+  struct icaltimetype after, before; /* Null time if not set */
+  char **summaries;		/* Case-folded, any of them must occur */
+  int nsummaries;
+  int active;			/* Whether anything was added */
+} evfilter;
+
+/* evfilter_init -- make a filter that accepts all events
+ *
+ * noclass is the class that events without CLASS property are
+ * supposed to have. */
+extern void evfilter_init(evfilter *f, const char *noclass);
+
+/* evfilter_add -- add a condition
+ *
+ * value is a single class, category or string, to add several call
+ * evfilter_add() for each of them.
+ * For EVFILTER_AFTER and EVFILTER_BEFORE, value is a date or date-time
+ * (yyyymmdd or yyyymmddThhmmss, UTC). Returns 0, or -1 if out of memory
+ * or the date is incorrect. */
+extern int evfilter_add(evfilter *f, evfilter_kind what, const char *value);
+
+/* evfilter_match -- check if an event passes all conditions
+ *
+ * The start of a recurring event (one with RRULE or RDATE) isn't
+ * checked, because its later instances may be in range. Use
+ * evfilter_starts_in() on each instance instead. */
+extern int evfilter_match(const evfilter *f, icalcomponent *ev);
+
+/* evfilter_starts_in -- check if a start is within the AFTER and BEFORE */
+extern int evfilter_starts_in(const evfilter *f,
+			      const struct icaltimetype start);
+
+/* evfilter_free -- free the memory used by a filter */
+extern void evfilter_free(evfilter *f);
+
+#endif /* EVFILTER_H */
@@ -0,0 +1,797 @@
+/*
+ * expand -- find the occurrences of events within a period
+ *
+ * Recurring events can be expanded by several threads. libical loads
+ * time zones and their transitions lazily, which isn't thread safe, so
+ * the zones are prepared in the main thread before the workers start
+ * and the workers expand into queues of their own.
+ *
+ * Created: 16 Oct 2026
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#ifdef HAVE_PTHREAD_H
+#  include <pthread.h>
+#endif
+#include <libical/ical.h>
+#include "calstream.h"
+#include "eventq.h"
+#include "expcache.h"
+#include "evfilter.h"
+#include "expand.h"
+
+#define ERR_OUT_OF_MEM 1	/* Program exit code */
+#define MAX_GUESS_PER_DAY 64	/* Occurrences per day to reserve at most */
+
+/* A recurring event waiting to be expanded */
+typedef struct _expand_job {
+  icalcomponent *event;
+  icalproperty **rrules;	/* All its RRULEs */
+  int nrrules;
+  struct icaltimetype *rdates;	/* RDATEs, in the time zone of DTSTART */
+  struct icaldurationtype *rdurs; /* Duration of each RDATE's instance */
+  int nrdates;
+  int periods;			/* Whether an RDATE has its own duration */
+  long long *exdates;		/* EXDATEs as sorted keys, see utc_key() */
+  int nexdates;
+  struct icaltimetype dtstart;
+  struct icaldurationtype dur;
+  struct icaltimetype recur_time; /* RECURRENCE-ID, normally null */
+  int seq;
+  char *key;			/* Key in the expansion cache, or NULL */
+} expand_job;
+
+/* An instance of a recurring event and its sort key */
+typedef struct _instance {
+  long long key;
+  struct icaltimetype start;
+  struct icaldurationtype dur;
+} instance;
+
+#ifdef HAVE_PTHREAD_H
+/* A thread and the queue it expands into */
+typedef struct _worker {
+  pthread_t thread;
+  selection *sel;
+  event_queue queue;
+  unsigned long steps;		/* Iterator steps of this worker */
+  unsigned long superseded;	/* Instances it left out */
+} worker;
+#endif
+
+
+/* out_of_memory -- print error message and exit */
+static void out_of_memory(void)
+{
+  fprintf(stderr, "Out of memory\n");
+  exit(ERR_OUT_OF_MEM);
+}
+
+
+/* prepare_zone -- load zone and its transitions up to until
+ *
+ * libical adds the transitions of a year when a time in it is first
+ * converted, so converting until does it for all earlier times. */
+static void prepare_zone(icaltimezone *zone, struct icaltimetype until)
+{
+  if (!zone) return;
+  until.is_date = 0;
+  until.is_utc = 0;
+  icaltime_set_timezone(&until, zone);
+  (void) icaltime_convert_to_zone(until, icaltimezone_get_utc_timezone());
+}
+
+
+/* expand_init -- select all events in a period, for one thread */
+void expand_init(selection *sel, event_queue *queue,
+		 const struct icaltimetype periodstart,
+		 const struct icaldurationtype duration,
+		 icaltimezone *tz)
+{
+  sel->periodstart = periodstart;
+  sel->periodend = icaltime_add(periodstart, duration);
+  sel->filter = NULL;
+  sel->tz = tz;
+  sel->days = icaldurationtype_as_int(duration) / (24 * 60 * 60);
+  sel->queue = queue;
+  sel->nthreads = 1;
+  sel->seq = 0;
+  sel->jobs = NULL;
+  sel->njobs = sel->jobsize = 0;
+  sel->cache = NULL;
+  sel->until = sel->periodend;
+#ifdef HAVE_PTHREAD_H
+  pthread_mutex_init(&sel->job_lock, NULL);
+  sel->next_job = 0;
+#endif
+  uidindex_init(&sel->overrides);
+  sel->expanded = sel->recheck = 0;
+  sel->filtered = sel->steps = sel->superseded = 0;
+  tzcache_init(&sel->zones, sel->periodstart, sel->periodend, tz);
+  if (tzcache_add(&sel->zones, tz) != 0) out_of_memory();
+}
+
+
+/* property_zone -- set the time zone of t to that of p's TZID parameter
+ *
+ * Like for DTSTART, the zone is looked for in the calendar, then in
+ * libical's built-in zones. */
+static struct icaltimetype property_zone(icalcomponent *ev, icalproperty *p,
+					 struct icaltimetype t)
+{
+  icalparameter *param;
+  icalcomponent *cal;
+  icaltimezone *zone = NULL;
+  const char *tzid;
+
+  if (!t.is_utc && !t.is_date
+      && (param = icalproperty_get_first_parameter(p, ICAL_TZID_PARAMETER))
+      && (tzid = icalparameter_get_tzid(param))) {
+    if ((cal = icalcomponent_get_parent(ev)))
+      zone = icalcomponent_get_timezone(cal, tzid);
+    if (!zone) zone = icaltimezone_get_builtin_timezone(tzid);
+    if (zone) icaltime_set_timezone(&t, zone);
+  }
+  return t;
+}
+
+
+/* recurrence_id -- the RECURRENCE-ID of an event, in its time zone */
+static struct icaltimetype recurrence_id(icalcomponent *ev)
+{
+  icalproperty *p;
+
+  p = icalcomponent_get_first_property(ev, ICAL_RECURRENCEID_PROPERTY);
+  if (!p) return icaltime_null_time();
+  return property_zone(ev, p, icalproperty_get_recurrenceid(p));
+}
+
+
+/* instance_key -- the key of an instance in sel->overrides */
+static char *instance_key(char buf[24], long long start_key)
+{
+  sprintf(buf, "%lld", start_key);
+  return buf;
+}
+
+
+/* utc_key -- the sort key of a time, see eventq_time_key() */
+static long long utc_key(const selection *sel, const struct icaltimetype t)
+{
+  return tzcache_utc_key(&sel->zones, t);
+}
+
+
+/* add_zone -- prepare fast conversions from and to the zone of t */
+static void add_zone(selection *sel, const struct icaltimetype t)
+{
+  if (tzcache_add(&sel->zones, icaltime_get_timezone(t)) != 0)
+    out_of_memory();
+}
+
+
+/* compare_keys -- compare two time keys, for qsort() */
+static int compare_keys(const void *a, const void *b)
+{
+  long long x = *(const long long *)a, y = *(const long long *)b;
+
+  return x < y ? -1 : x > y;
+}
+
+
+/* compare_instances -- compare two instances by start, for qsort() */
+static int compare_instances(const void *a, const void *b)
+{
+  return compare_keys(&((const instance *)a)->key,
+		      &((const instance *)b)->key);
+}
+
+
+/* recurrence_set -- get the RRULEs, RDATEs and EXDATEs of job->event
+ *
+ * Returns 0 if the event has neither RRULEs nor RDATEs, i.e., isn't
+ * recurring. Looks up time zones, so call it from the main thread. */
+static int recurrence_set(expand_job *job, const selection *sel)
+{
+  icalcomponent *ev = job->event;
+  const icaltimezone *zone = icaltime_get_timezone(job->dtstart);
+  struct icaldatetimeperiodtype rdate;
+  struct icaldurationtype dur;
+  struct icaltimetype t;
+  icalproperty *p;
+  int n;
+
+  job->rrules = NULL;
+  job->rdates = NULL;
+  job->rdurs = NULL;
+  job->exdates = NULL;
+  job->nrrules = job->nrdates = job->nexdates = job->periods = 0;
+
+  n = icalcomponent_count_properties(ev, ICAL_RRULE_PROPERTY);
+  if (n && !(job->rrules = malloc(n * sizeof(*job->rrules))))
+    out_of_memory();
+  for (p = icalcomponent_get_first_property(ev, ICAL_RRULE_PROPERTY); p;
+       p = icalcomponent_get_next_property(ev, ICAL_RRULE_PROPERTY))
+    job->rrules[job->nrrules++] = p;
+
+  /* An RDATE with a PERIOD has the period's length, other RDATEs the
+   * event's duration. They are converted to the zone of DTSTART, like
+   * the instances of the rules are in, and like the cache stores them. */
+  n = icalcomponent_count_properties(ev, ICAL_RDATE_PROPERTY);
+  if (n && (!(job->rdates = malloc(n * sizeof(*job->rdates)))
+	    || !(job->rdurs = malloc(n * sizeof(*job->rdurs)))))
+    out_of_memory();
+  if (n) dur = icalcomponent_get_duration(ev);
+  for (p = icalcomponent_get_first_property(ev, ICAL_RDATE_PROPERTY); p;
+       p = icalcomponent_get_next_property(ev, ICAL_RDATE_PROPERTY)) {
+    rdate = icalproperty_get_rdate(p);
+    if (!icaltime_is_null_time(rdate.time)) {
+      t = rdate.time;
+      job->rdurs[job->nrdates] = dur;
+    } else {
+      t = rdate.period.start;
+      job->rdurs[job->nrdates] = icaltime_is_null_time(rdate.period.end)
+	? rdate.period.duration
+	: icaltime_subtract(rdate.period.end, rdate.period.start);
+      job->periods = 1;
+    }
+    if (icaltime_is_null_time(t)) continue;
+    t = property_zone(ev, p, t);
+    if (zone && !t.is_date)
+      t = icaltime_convert_to_zone(t, (icaltimezone *)zone);
+    job->rdates[job->nrdates++] = t;
+  }
+
+  /* Sorted, so that each instance costs a binary search */
+  n = icalcomponent_count_properties(ev, ICAL_EXDATE_PROPERTY);
+  if (n && !(job->exdates = malloc(n * sizeof(*job->exdates))))
+    out_of_memory();
+  for (p = icalcomponent_get_first_property(ev, ICAL_EXDATE_PROPERTY); p;
+       p = icalcomponent_get_next_property(ev, ICAL_EXDATE_PROPERTY)) {
+    t = icalproperty_get_exdate(p);
+    if (icaltime_is_null_time(t)) continue;
+    job->exdates[job->nexdates++] = utc_key(sel, property_zone(ev, p, t));
+  }
+  qsort(job->exdates, job->nexdates, sizeof(*job->exdates), compare_keys);
+
+  return job->nrrules || job->nrdates;
+}
+
+
+/* free_job -- free what a job allocated */
+static void free_job(expand_job *job)
+{
+  free(job->rrules);
+  free(job->rdates);
+  free(job->rdurs);
+  free(job->exdates);
+  free(job->key);
+}
+
+
+/* is_excluded -- check if an EXDATE excludes the instance at start_key */
+static int is_excluded(const expand_job *job, long long start_key)
+{
+  int lo = 0, hi = job->nexdates - 1, mid;
+
+  while (lo <= hi) {
+    mid = lo + (hi - lo) / 2;
+    if (job->exdates[mid] < start_key) lo = mid + 1;
+    else if (job->exdates[mid] > start_key) hi = mid - 1;
+    else return 1;
+  }
+  return 0;
+}
+
+
+/* add_override -- remember the instance of its series that ev replaces
+ *
+ * The index has (UID, start of the instance in UTC) for each override
+ * and (UID, "") for each series that has overrides. */
+static void add_override(selection *sel, icalcomponent *ev,
+			 const struct icaltimetype rid)
+{
+  const char *uid = icalcomponent_get_uid(ev);
+  char key[24];
+  long *v;
+
+  if (!uid) return;
+  if (!(v = uidindex_find(&sel->overrides, uid, ""))) out_of_memory();
+  *v = 1;
+  if (!(v = uidindex_find(&sel->overrides, uid,
+			  instance_key(key, utc_key(sel, rid)))))
+    out_of_memory();
+
+  /* Too late for a series that was already expanded */
+  if (*v < 0 && sel->expanded) sel->recheck = 1;
+  *v = 1;
+}
+
+
+/* is_overridden -- check if an override replaces the instance at start */
+static int is_overridden(const selection *sel, const char *uid,
+			 long long start_key)
+{
+  char key[24];
+
+  return uidindex_get(&sel->overrides, uid, instance_key(key, start_key))
+    != NULL;
+}
+
+
+/* has_overrides -- check if an event is a series with overrides */
+static int has_overrides(const selection *sel, const expand_job *job)
+{
+  const char *uid = icalcomponent_get_uid(job->event);
+
+  return icaltime_is_null_time(job->recur_time) && uid
+    && uidindex_get(&sel->overrides, uid, "");
+}
+
+
+/* add_to_queue -- add event to queue of events to print */
+static void add_to_queue(event_queue *q, icalcomponent *ev, int seq,
+			 const struct icaltimetype start,
+			 const struct icaltimetype end,
+			 const struct icaltimetype recur_time,
+			 const selection *sel)
+{
+  const tzcache *c = &sel->zones;
+  event_item *item;
+
+  if (!(item = eventq_append(q))) out_of_memory();
+
+  /* Sort keys, so that sorting doesn't need icaltime_compare() */
+  item->start_key = tzcache_utc_key(c, start);
+  item->end_key = tzcache_utc_key(c, end);
+  item->recur_key = tzcache_utc_key(c, recur_time);
+
+  item->start = tzcache_convert(c, start, item->start_key, sel->tz);
+  item->end = tzcache_convert(c, end, item->end_key, sel->tz);
+  item->uid = icalcomponent_get_uid(ev);
+  item->recur_time = tzcache_convert(c, recur_time, item->recur_key, sel->tz);
+  item->event = ev;
+  item->seq = seq;
+  if ((item->uid_key = eventq_uid_key(q, item->uid)) < 0) out_of_memory();
+}
+
+
+/* is_simple_rule -- check that a rule has only FREQ, INTERVAL, COUNT, UNTIL */
+static int is_simple_rule(const struct icalrecurrencetype *r)
+{
+  return r->by_second[0] == ICAL_RECURRENCE_ARRAY_MAX
+    && r->by_minute[0] == ICAL_RECURRENCE_ARRAY_MAX
+    && r->by_hour[0] == ICAL_RECURRENCE_ARRAY_MAX
+    && r->by_day[0] == ICAL_RECURRENCE_ARRAY_MAX
+    && r->by_month_day[0] == ICAL_RECURRENCE_ARRAY_MAX
+    && r->by_year_day[0] == ICAL_RECURRENCE_ARRAY_MAX
+    && r->by_week_no[0] == ICAL_RECURRENCE_ARRAY_MAX
+    && r->by_month[0] == ICAL_RECURRENCE_ARRAY_MAX
+    && r->by_set_pos[0] == ICAL_RECURRENCE_ARRAY_MAX;
+}
+
+
+/* skip_ahead -- move dtstart of a simple rule to just before the period
+ *
+ * For a rule without BY* parts, every step of FREQ*INTERVAL from
+ * dtstart is an occurrence, so we can jump over the ones that end
+ * before the period instead of iterating over them. Steps are counted
+ * on the local fields, like the iterator does, and conservatively (two
+ * days early, months of 31 days) so that time zones don't matter.
+ * Returns 0 if COUNT says no occurrences are left. */
+static int skip_ahead(struct icalrecurrencetype *recur,
+		      struct icaltimetype *dtstart,
+		      const struct icaldurationtype dur,
+		      const selection *sel)
+{
+  const struct icaltimetype *p = &sel->periodstart;
+  long long gap, step, k;
+  int interval = recur->interval > 0 ? recur->interval : 1, months;
+
+  if (!is_simple_rule(recur)) return 1;
+
+  /* Seconds from dtstart to the last start that surely ends too early */
+  gap = (eventq_day_number(p->year, p->month, p->day)
+	 - eventq_day_number(dtstart->year, dtstart->month, dtstart->day)
+	 - 2) * 86400LL
+    + (p->hour - dtstart->hour) * 3600LL
+    + (p->minute - dtstart->minute) * 60LL
+    + (p->second - dtstart->second)
+    - icaldurationtype_as_int(dur);
+  if (gap <= 0) return 1;
+
+  switch (recur->freq) {
+  case ICAL_SECONDLY_RECURRENCE: step = 1; break;
+  case ICAL_MINUTELY_RECURRENCE: step = 60; break;
+  case ICAL_HOURLY_RECURRENCE: step = 3600; break;
+  case ICAL_DAILY_RECURRENCE: step = 86400; break;
+  case ICAL_WEEKLY_RECURRENCE: step = 7 * 86400; break;
+  case ICAL_MONTHLY_RECURRENCE: step = 31 * 86400; break;
+  case ICAL_YEARLY_RECURRENCE: step = 366 * 86400; break;
+  default: return 1;
+  }
+  k = gap / (step * interval);	/* Number of occurrences to skip */
+  if (k <= 0) return 1;
+
+  /* Not every month has a 29th, 30th or 31st */
+  if ((recur->freq == ICAL_MONTHLY_RECURRENCE
+       || recur->freq == ICAL_YEARLY_RECURRENCE) && dtstart->day > 28)
+    return 1;
+
+  if (recur->count > 0) {
+    if (recur->count <= k) return 0; /* Series ended before the period */
+    recur->count -= k;
+  }
+
+  if (recur->freq == ICAL_MONTHLY_RECURRENCE
+      || recur->freq == ICAL_YEARLY_RECURRENCE) {
+    months = dtstart->month - 1 + k * interval
+      * (recur->freq == ICAL_YEARLY_RECURRENCE ? 12 : 1);
+    dtstart->year += months / 12;
+    dtstart->month = months % 12 + 1;
+  } else {
+    k *= step * interval;
+    icaltime_adjust(dtstart, k / 86400, 0, 0, k % 86400);
+  }
+  return 1;
+}
+
+
+/* add_instance -- add an instance to a growing array */
+static void add_instance(const selection *sel, instance **v, int *n,
+			 int *size, const struct icaltimetype start,
+			 const struct icaldurationtype dur)
+{
+  if (*n == *size) {
+    *size = 2 * *size + 16;
+    if (!(*v = realloc(*v, *size * sizeof(**v)))) out_of_memory();
+  }
+  (*v)[*n].start = start;
+  (*v)[*n].dur = dur;
+  (*v)[(*n)++].key = utc_key(sel, start);
+}
+
+
+/* in_period -- check if an instance starting at start is in the period */
+static int in_period(const selection *sel, const struct icaltimetype start,
+		     const struct icaldurationtype dur)
+{
+  return icaltime_compare(start, sel->periodend) <= 0
+    && icaltime_compare(icaltime_add(start, dur), sel->periodstart) >= 0;
+}
+
+
+/* queue_instances -- queue instances that no override replaces
+ *
+ * Also leaves out instances that start outside the filter's range.
+ * Adds the number of instances that overrides replace to *superseded. */
+static void queue_instances(const expand_job *job, event_queue *q,
+			    const selection *sel, const instance *v, int n,
+			    unsigned long *superseded)
+{
+  const char *uid = icalcomponent_get_uid(job->event);
+  int i, overrides = has_overrides(sel, job);
+
+  for (i = 0; i < n; i++) {
+    if (sel->filter && !evfilter_starts_in(sel->filter, v[i].start))
+      continue;
+    if (overrides && is_overridden(sel, uid, v[i].key))
+      (*superseded)++;
+    else
+      add_to_queue(q, job->event, job->seq, v[i].start,
+		   icaltime_add(v[i].start, v[i].dur), job->recur_time, sel);
+  }
+}
+
+
+/* expand_recurring -- queue the occurrences of a recurring event
+ *
+ * The occurrences are the instances of all RRULEs, the RDATEs and,
+ * without RRULEs, DTSTART, minus the EXDATEs. Adds the number of steps
+ * the iterators took to *steps and the number of instances that
+ * overrides replace to *superseded. */
+static void expand_recurring(const expand_job *job, event_queue *q,
+			     const selection *sel, unsigned long *steps,
+			     unsigned long *superseded)
+{
+  struct icaltimetype next, dtstart, *times;
+  struct icalrecurrencetype recur;
+  icalrecur_iterator *ritr;
+  instance *v = NULL;
+  int n = 0, size = 0, i, j;
+
+  for (i = 0; i < job->nrrules; i++) {
+
+    /* Jump close to the period if the rule is simple enough */
+    dtstart = job->dtstart;
+    recur = icalproperty_get_rrule(job->rrules[i]);
+    if (!skip_ahead(&recur, &dtstart, job->dur, sel)) continue;
+
+    /* Iterate to find occurrences within our period */
+    ritr = icalrecur_iterator_new(recur, dtstart);
+    while ((*steps)++, next = icalrecur_iterator_next(ritr),
+	   !icaltime_is_null_time(next)
+	   && icaltime_compare(next, sel->periodend) <= 0)
+      if (in_period(sel, next, job->dur))
+	add_instance(sel, &v, &n, &size, next, job->dur);
+    icalrecur_iterator_free(ritr);
+  }
+
+  /* An RRULE's iterator already returns DTSTART */
+  if (job->nrrules == 0 && in_period(sel, job->dtstart, job->dur))
+    add_instance(sel, &v, &n, &size, job->dtstart, job->dur);
+  for (i = 0; i < job->nrdates; i++)
+    if (in_period(sel, job->rdates[i], job->rdurs[i]))
+      add_instance(sel, &v, &n, &size, job->rdates[i], job->rdurs[i]);
+
+  /* A single source is in order already, more may overlap */
+  if (job->nrrules + job->nrdates + (job->nrrules == 0) > 1)
+    qsort(v, n, sizeof(*v), compare_instances);
+  for (i = j = 0; i < n; i++)
+    if ((j == 0 || v[i].key != v[j-1].key) && !is_excluded(job, v[i].key))
+      v[j++] = v[i];
+  n = j;
+
+  queue_instances(job, q, sel, v, n, superseded);
+
+  /* Remember them for the cache */
+  if (job->key) {
+    if (!(times = malloc((n + 1) * sizeof(*times)))) out_of_memory();
+    for (i = 0; i < n; i++) times[i] = v[i].start;
+    expcache_store(sel->cache, job->key, times, n);
+    free(times);
+  }
+  free(v);
+}
+
+
+/* expand_cached -- queue the occurrences from the cache, if it has them */
+static int expand_cached(const expand_job *job, event_queue *q,
+			 selection *sel)
+{
+  struct icaltimetype *times;
+  instance *v;
+  int n, i;
+
+  if ((n = expcache_load(sel->cache, job->key, job->dtstart, &times)) < 0)
+    return 0;
+  if (!(v = malloc((n + 1) * sizeof(*v)))) out_of_memory();
+  for (i = 0; i < n; i++) {
+    v[i].start = times[i];
+    v[i].dur = job->dur;
+    v[i].key = utc_key(sel, times[i]);
+  }
+  queue_instances(job, q, sel, v, n, &sel->superseded);
+  free(times);
+  free(v);
+  return 1;
+}
+
+
+/* expand_event -- queue the occurrences of one VEVENT within the period */
+int expand_event(icalcomponent *h, void *data)
+{
+  const struct icaldurationtype one = {0, 1, 0, 0, 0, 0};
+  selection *sel = (selection *)data;
+  struct icaltimetype dtstart, dtend, d, rid;
+  struct icaldurationtype longest;
+  expand_job job, *jobs;
+  int n = sel->queue->n, guess, i;
+
+  if (icalcomponent_isa(h) != ICAL_VEVENT_COMPONENT) return CALSTREAM_KEEP;
+  sel->seq++;
+
+  /* Before the first event, guess the size of the queue: an occurrence
+   * per VEVENT in the calendar (unknown when streaming) and a few per day.
+   * Most events of a big calendar are outside a short period, so don't
+   * reserve more than the period is likely to need, the queue grows. */
+  if (sel->queue->size == 0) {
+    guess = icalcomponent_count_components(icalcomponent_get_parent(h),
+					   ICAL_VEVENT_COMPONENT);
+    if (guess > MAX_GUESS_PER_DAY * sel->days)
+      guess = MAX_GUESS_PER_DAY * sel->days;
+    if (eventq_reserve(sel->queue, guess + 4 * sel->days) != 0)
+      out_of_memory();
+  }
+
+  /* An override hides the instance it replaces, even if it doesn't
+   * pass the filter itself or has moved out of the period */
+  rid = recurrence_id(h);
+  add_zone(sel, rid);
+  if (!icaltime_is_null_time(rid)) add_override(sel, h, rid);
+
+  /* Check if the event passes the filter (unless we accept all) */
+  if (sel->filter && !evfilter_match(sel->filter, h)) {
+    sel->filtered++;
+    return CALSTREAM_FREE;
+  }
+
+  /* Get start time and recurrence rules and dates (if any) */
+  dtstart = icalcomponent_get_dtstart(h);
+  job.event = h;
+  job.dtstart = dtstart;
+  job.key = NULL;
+
+  add_zone(sel, dtstart);
+  if (!recurrence_set(&job, sel)) {	/* Not recurring */
+
+    /* Check if this event is at least partially within our period */
+    if (icaltime_compare(dtstart, sel->periodend) <= 0) {
+      dtend = icalcomponent_get_dtend(h);
+      if (dtend.year + dtend.month + dtend.day + dtend.hour + dtend.minute +
+	  dtend.second == 0) dtend = dtstart;
+      if (icaltime_compare(sel->periodstart, dtend) <= 0) {
+
+	/* Add to as many days as it spans */
+	d = dtstart;
+	do {
+	  add_to_queue(sel->queue, h, sel->seq, d, dtend, rid, sel);
+	  d = icaltime_add(d, one);
+	} while (icaltime_compare(d, dtend) < 0);
+      }
+    }
+
+  } else {			/* Recurring event */
+
+    /* RDATEs may be before DTSTART */
+    if (icaltime_compare(dtstart, sel->periodend) <= 0 || job.nrdates) {
+      job.dur = icalcomponent_get_duration(h);
+      job.recur_time = rid;
+      job.seq = sel->seq;
+
+      /* The cache has only start times, so not RDATE periods */
+      if (sel->cache && !job.periods
+	  && !(job.key = expcache_key(h, dtstart, job.dur, sel->periodstart,
+				      sel->periodend)))
+	out_of_memory();
+
+      if (job.key && expand_cached(&job, sel->queue, sel)) {
+	sel->expanded++;
+      } else if (sel->nthreads <= 1) {
+	expand_recurring(&job, sel->queue, sel, &sel->steps, &sel->superseded);
+	sel->expanded++;
+      } else {
+	/* Leave it for expand_finish() */
+	if (sel->njobs == sel->jobsize) {
+	  sel->jobsize = 2 * sel->jobsize + 64;
+	  if (! (jobs = realloc(sel->jobs, sel->jobsize * sizeof(*jobs))))
+	    out_of_memory();
+	  sel->jobs = jobs;
+	}
+	sel->jobs[sel->njobs++] = job;
+
+	/* The workers convert times up to the end of the last instance */
+	longest = job.dur;
+	for (i = 0; i < job.nrdates; i++)
+	  if (icaldurationtype_as_int(job.rdurs[i])
+	      > icaldurationtype_as_int(longest))
+	    longest = job.rdurs[i];
+	d = icaltime_add(sel->periodend, longest);
+	if (icaltime_compare(d, sel->until) > 0) sel->until = d;
+	prepare_zone((icaltimezone *)icaltime_get_timezone(dtstart), d);
+	return CALSTREAM_KEEP;
+      }
+    }
+  }
+
+  free_job(&job);
+
+  /* Keep the event only if it is referenced from the queue */
+  return sel->queue->n != n ? CALSTREAM_KEEP : CALSTREAM_FREE;
+}
+
+
+/* expand_calendar -- queue the occurrences of all VEVENTs in a VCALENDAR */
+void expand_calendar(icalcomponent *cal, selection *sel)
+{
+  struct icaltimetype rid;
+  icalcomponent *h;
+
+  /* Index the overrides first, so no series needs to be checked again */
+  for (h = icalcomponent_get_first_component(cal, ICAL_VEVENT_COMPONENT); h;
+       h = icalcomponent_get_next_component(cal, ICAL_VEVENT_COMPONENT))
+    if (!icaltime_is_null_time(rid = recurrence_id(h)))
+      add_override(sel, h, rid);
+
+  for (h = icalcomponent_get_first_component(cal, ICAL_VEVENT_COMPONENT); h;
+       h = icalcomponent_get_next_component(cal, ICAL_VEVENT_COMPONENT))
+    (void) expand_event(h, sel);
+}
+
+
+#ifdef HAVE_PTHREAD_H
+/* run_worker -- expand jobs into the worker's queue until none are left */
+static void *run_worker(void *arg)
+{
+  worker *w = (worker *)arg;
+  int i;
+
+  for (;;) {
+    pthread_mutex_lock(&w->sel->job_lock);
+    i = w->sel->next_job++;
+    pthread_mutex_unlock(&w->sel->job_lock);
+    if (i >= w->sel->njobs) break;
+    expand_recurring(&w->sel->jobs[i], &w->queue, w->sel, &w->steps,
+		     &w->superseded);
+  }
+  return NULL;
+}
+#endif
+
+
+/* drop_superseded -- remove instances that overrides replace from the queue
+ *
+ * Only needed if an override came after its series had been expanded,
+ * which can happen when streaming. */
+static void drop_superseded(selection *sel)
+{
+  event_queue *q = sel->queue;
+  event_item *e;
+  int i, j = 0;
+
+  for (i = 0; i < q->n; i++) {
+    e = &q->items[i];
+    if (e->recur_key == EVENTQ_NULL_KEY && e->uid
+	&& (icalcomponent_get_first_property(e->event, ICAL_RRULE_PROPERTY)
+	    || icalcomponent_get_first_property(e->event, ICAL_RDATE_PROPERTY))
+	&& is_overridden(sel, e->uid, e->start_key))
+      sel->superseded++;
+    else
+      q->items[j++] = *e;
+  }
+  q->n = j;
+}
+
+
+/* expand_finish -- expand the recurring events that were left over */
+void expand_finish(selection *sel)
+{
+  int i, todo = sel->njobs;
+#ifdef HAVE_PTHREAD_H
+  int n = sel->nthreads;
+  worker *w;
+
+  /* The main thread is worker 0, it finishes the jobs if need be */
+  if (n > sel->njobs) n = sel->njobs;
+  if (n > 1 && (w = calloc(n, sizeof(*w)))) {
+    prepare_zone(sel->tz, sel->until);
+    sel->next_job = 0;
+    for (i = 0; i < n; i++) {w[i].sel = sel; eventq_init(&w[i].queue);}
+    for (i = 1; i < n; i++)
+      if (pthread_create(&w[i].thread, NULL, run_worker, &w[i]) != 0) break;
+    n = i;
+    run_worker(&w[0]);
+    for (i = 1; i < n; i++) pthread_join(w[i].thread, NULL);
+
+    /* Merge the queues, the sort keys make the order deterministic */
+    for (i = 0; i < n; i++) {
+      if (eventq_append_queue(sel->queue, &w[i].queue) != 0) out_of_memory();
+      eventq_free(&w[i].queue);
+      sel->steps += w[i].steps;
+      sel->superseded += w[i].superseded;
+    }
+    free(w);
+    todo = 0;
+  }
+#endif
+
+  /* Without threads, just do them in order */
+  for (i = 0; i < todo; i++)
+    expand_recurring(&sel->jobs[i], sel->queue, sel, &sel->steps,
+		     &sel->superseded);
+
+  if (sel->recheck) drop_superseded(sel);
+
+  for (i = 0; i < sel->njobs; i++) free_job(&sel->jobs[i]);
+  free(sel->jobs);
+  sel->jobs = NULL;
+  sel->njobs = sel->jobsize = 0;
+  uidindex_free(&sel->overrides);
+  tzcache_free(&sel->zones);
+#ifdef HAVE_PTHREAD_H
+  pthread_mutex_destroy(&sel->job_lock);
+#endif
+}
@@ -0,0 +1,78 @@
+/*
+ * expand -- find the occurrences of events within a period
+ *
+ * Created: 16 Oct 2026
+ */
+
+#ifndef EXPAND_H
+#define EXPAND_H
+
+#include <libical/ical.h>
+#ifdef HAVE_PTHREAD_H
+#  include <pthread.h>
+#endif
+#include "eventq.h"
+#include "expcache.h"
+#include "evfilter.h"
+#include "uidindex.h"
+#include "tzcache.h"
+
+struct _expand_job;
+
+/* Which events to select and where to put them, see expand_event() */
+typedef struct _selection {
+  struct icaltimetype periodstart, periodend;
+  const evfilter *filter;	/* Which events, NULL for all */
+  icaltimezone *tz;
+  int days;			/* Length of the period in days */
+  event_queue *queue;		/* Where to put the occurrences */
+  int nthreads;			/* Number of threads for recurring events */
+  int seq;			/* Number of VEVENTs seen so far */
+  struct _expand_job *jobs;	/* Recurring events left for expand_finish() */
+  int njobs, jobsize;
+  struct icaltimetype until;	/* Latest end of an instance of a job */
+#ifdef HAVE_PTHREAD_H
+  pthread_mutex_t job_lock;	/* Protects next_job */
+  int next_job;			/* Next job for a worker */
+#endif
+  expcache *cache;		/* Cache of occurrences, or NULL */
+  uidindex overrides;		/* Instances that overrides replace */
+  tzcache zones;		/* Offsets of the zones of the events */
+  int expanded;			/* Recurring events expanded so far */
+  int recheck;			/* Whether an override came too late */
+  unsigned long filtered;	/* VEVENTs the filter rejected */
+  unsigned long steps;		/* Steps of the recurrence iterators */
+  unsigned long superseded;	/* Instances left out for an override */
+} selection;
+
+/* expand_init -- select all events in a period, for one thread */
+extern void expand_init(selection *sel, event_queue *queue,
+			const struct icaltimetype periodstart,
+			const struct icaldurationtype duration,
+			icaltimezone *tz);
+
+/* expand_event -- queue the occurrences of one VEVENT within the period
+ *
+ * A calstream_handler, data is a selection. If sel->nthreads > 1,
+ * recurring events are only checked and kept, expand_finish() expands
+ * them. A recurring event is one with RRULEs or RDATEs, its EXDATEs
+ * and the instances that a VEVENT with a RECURRENCE-ID replaces are
+ * not queued. Returns CALSTREAM_KEEP if the event may be
+ * in the queue. */
+extern int expand_event(icalcomponent *h, void *data);
+
+/* expand_calendar -- queue the occurrences of all VEVENTs in a VCALENDAR
+ *
+ * Like calling expand_event() for each of them, for a calendar that
+ * was parsed earlier, but all overrides are known before any series is
+ * expanded. The calendar is not changed. */
+extern void expand_calendar(icalcomponent *cal, selection *sel);
+
+/* expand_finish -- expand the recurring events that were left over
+ *
+ * Also removes the instances of series that were expanded before the
+ * override that replaces them was seen (which can happen when
+ * streaming) and frees the memory of the selection, except the queue. */
+extern void expand_finish(selection *sel);
+
+#endif /* EXPAND_H */
@@ -0,0 +1,245 @@
+/*
+ * expcache -- on-disk cache of the occurrences of recurring events
+ *
+ * A cache file looks like this:
+ *
+ *     <key>
+ *     <number of occurrences>
+ *     20261016T090000
+ *     20261023T090000
+ *     ...
+ *
+ * with one start time (in the time zone of the event's DTSTART) per
+ * line, or only a date for all-day events. Files are written to a
+ * temporary name and then renamed, so readers never see half a file.
+ * Loading an entry updates its modification time, so that old entries
+ * of past periods can be pruned by age.
+ *
+ * Created: 16 Oct 2026
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <dirent.h>
+#include <utime.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <libical/ical.h>
+#include "expcache.h"
+
+#define TIME_LEN 16		/* Length of "yyyymmddThhmmss" + 1 */
+
+
+/* hash -- FNV-1a hash of a string, names the cache file */
+static unsigned long long hash(const char *s)
+{
+  unsigned long long h = 14695981039346656037ULL;
+
+  for (; *s; s++) h = (h ^ (unsigned char)*s) * 1099511628211ULL;
+  return h;
+}
+
+
+/* format_time -- write t as yyyymmdd or yyyymmddThhmmss into buf */
+static void format_time(char buf[TIME_LEN], const struct icaltimetype t)
+{
+  if (icaltime_is_null_time(t))
+    buf[0] = '\0';
+  else if (t.is_date)
+    sprintf(buf, "%04d%02d%02d", t.year, t.month, t.day);
+  else
+    sprintf(buf, "%04d%02d%02dT%02d%02d%02d", t.year, t.month, t.day,
+	    t.hour, t.minute, t.second);
+}
+
+
+/* expcache_init -- use (and create, if needed) directory dir as cache */
+int expcache_init(expcache *c, const char *dir)
+{
+  c->dir = dir;
+  c->hits = c->misses = 0;
+  if (mkdir(dir, 0777) != 0 && errno != EEXIST) return -1;
+  return 0;
+}
+
+
+/* expcache_key -- make the cache key of a recurring event in a period */
+char *expcache_key(icalcomponent *ev, const struct icaltimetype dtstart,
+		   const struct icaldurationtype dur,
+		   const struct icaltimetype periodstart,
+		   const struct icaltimetype periodend)
+{
+  static const icalproperty_kind kinds[] = {
+    ICAL_RRULE_PROPERTY, ICAL_RDATE_PROPERTY, ICAL_EXDATE_PROPERTY};
+  char start[TIME_LEN], modified[TIME_LEN], pstart[TIME_LEN], pend[TIME_LEN];
+  const char *uid, *tzid, *rule;
+  icalproperty *p;
+  char *key, *rules = NULL, *s;
+  size_t len, n = 0, size = 0;
+  int i;
+
+  /* Every rule and date of the recurrence set, with their parameters */
+  for (i = 0; i < (int)(sizeof(kinds) / sizeof(kinds[0])); i++)
+    for (p = icalcomponent_get_first_property(ev, kinds[i]); p;
+	 p = icalcomponent_get_next_property(ev, kinds[i])) {
+      rule = icalproperty_as_ical_string(p);
+      len = strlen(rule);
+      if (n + len + 2 > size) {
+	size = 2 * size + len + 64;
+	if (!(s = realloc(rules, size))) {free(rules); return NULL;}
+	rules = s;
+      }
+      if (n) rules[n++] = ' ';
+      strcpy(rules + n, rule);
+      n += len;
+    }
+
+  /* Producers don't always increase SEQUENCE when they change the
+   * rules, so the key also has everything the occurrences depend on */
+  uid = icalcomponent_get_uid(ev);
+  p = icalcomponent_get_first_property(ev, ICAL_LASTMODIFIED_PROPERTY);
+  format_time(modified, p ? icalproperty_get_lastmodified(p)
+	      : icaltime_null_time());
+  tzid = icaltime_get_tzid(dtstart);
+  format_time(start, dtstart);
+  format_time(pstart, periodstart);
+  format_time(pend, periodend);
+
+  len = strlen(uid ? uid : "") + strlen(tzid ? tzid : "") + n
+    + 4 * TIME_LEN + 2 * 24 + 16;
+  if (!(key = malloc(len))) {free(rules); return NULL;}
+  sprintf(key, "%s\t%d\t%s\t%s\t%s\t%d\t%s\t%s\t%s", uid ? uid : "",
+	  icalcomponent_get_sequence(ev), modified, tzid ? tzid : "", start,
+	  icaldurationtype_as_int(dur), rules ? rules : "", pstart, pend);
+  free(rules);
+
+  /* The key is the first line of the file */
+  for (s = key; *s; s++) if (*s == '\n' || *s == '\r') *s = ' ';
+  return key;
+}
+
+
+/* expcache_load -- look up the occurrences stored under key */
+int expcache_load(expcache *c, const char *key,
+		  const struct icaltimetype tmpl,
+		  struct icaltimetype **times)
+{
+  char path[4096], *buf = NULL, *p;
+  size_t keylen = strlen(key);
+  struct stat st;
+  int n = -1, i, fields;
+  FILE *f;
+
+  *times = NULL;
+  snprintf(path, sizeof(path), "%s/%016llx", c->dir, hash(key));
+  if (!(f = fopen(path, "r"))) goto miss;
+
+  /* Read the whole file and check that it is for this key */
+  if (fstat(fileno(f), &st) != 0 || st.st_size <= keylen
+      || !(buf = malloc(st.st_size + 1))
+      || fread(buf, 1, st.st_size, f) != st.st_size)
+    goto miss;
+  buf[st.st_size] = '\0';
+  if (strncmp(buf, key, keylen) != 0 || buf[keylen] != '\n') goto miss;
+
+  /* Then the count and the start times */
+  p = buf + keylen + 1;
+  if ((n = strtol(p, &p, 10)) < 0 || *p != '\n') goto miss;
+  if (n > 0 && !(*times = malloc(n * sizeof(**times)))) goto miss;
+  for (i = 0; i < n; i++) {
+    (*times)[i] = tmpl;
+    fields = sscanf(p, "\n%4d%2d%2dT%2d%2d%2d", &(*times)[i].year,
+		    &(*times)[i].month, &(*times)[i].day, &(*times)[i].hour,
+		    &(*times)[i].minute, &(*times)[i].second);
+    if (fields != 3 && fields != 6) goto miss;
+    (*times)[i].is_date = fields == 3;
+    if (!(p = strchr(p + 1, '\n'))) goto miss;
+  }
+  if (p[1] != '\0') goto miss;
+
+  /* The modification time says when the entry was last used */
+  (void) utime(path, NULL);
+  fclose(f);
+  free(buf);
+  c->hits++;
+  return n;
+
+ miss:
+  if (f) fclose(f);
+  free(buf);
+  free(*times);
+  *times = NULL;
+  c->misses++;
+  return -1;
+}
+
+
+/* is_entry -- check if a file name is that of an entry or a temporary */
+static int is_entry(const char *name)
+{
+  int i;
+
+  for (i = 0; i < 16; i++) if (!isxdigit((unsigned char)name[i])) return 0;
+  return name[16] == '\0' || name[16] == '.';
+}
+
+
+/* expcache_prune -- remove entries that weren't used for days days */
+int expcache_prune(const expcache *c, int days)
+{
+  char path[4096], stamp[4096];
+  time_t now = time(NULL);
+  struct dirent *e;
+  struct stat st;
+  int n = 0, fd;
+  DIR *d;
+
+  /* Once a day is enough */
+  snprintf(stamp, sizeof(stamp), "%s/pruned", c->dir);
+  if (stat(stamp, &st) == 0 && st.st_mtime > now - 24 * 60 * 60) return 0;
+  if ((fd = open(stamp, O_WRONLY | O_CREAT, 0666)) < 0) return -1;
+  close(fd);
+  (void) utime(stamp, NULL);
+
+  if (!(d = opendir(c->dir))) return -1;
+  while ((e = readdir(d))) {
+    if (!is_entry(e->d_name)) continue;
+    snprintf(path, sizeof(path), "%s/%s", c->dir, e->d_name);
+    if (stat(path, &st) == 0 && S_ISREG(st.st_mode)
+	&& st.st_mtime < now - days * 24L * 60 * 60 && unlink(path) == 0)
+      n++;
+  }
+  closedir(d);
+  return n;
+}
+
+
+/* expcache_store -- store n occurrences under key */
+void expcache_store(const expcache *c, const char *key,
+		    const struct icaltimetype *times, int n)
+{
+  char path[4096], tmp[4096], t[TIME_LEN];
+  int fd, i, ok;
+  FILE *f;
+
+  snprintf(path, sizeof(path), "%s/%016llx", c->dir, hash(key));
+  snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+  if ((fd = mkstemp(tmp)) < 0) return;
+  if (!(f = fdopen(fd, "w"))) {close(fd); unlink(tmp); return;}
+
+  fprintf(f, "%s\n%d\n", key, n);
+  for (i = 0; i < n; i++) {
+    format_time(t, times[i]);
+    fprintf(f, "%s\n", t);
+  }
+  ok = !ferror(f);
+  if (fclose(f) != 0) ok = 0;
+  if (!ok || rename(tmp, path) != 0) unlink(tmp);
+}
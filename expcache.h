@@ -0,0 +1,61 @@
+/*
+ * expcache -- on-disk cache of the occurrences of recurring events
+ *
+ * Each entry is a file in the cache directory, named after a hash of
+ * its key. The key identifies the event (UID, SEQUENCE, LAST-MODIFIED
+ * and what the occurrences are computed from) and the period, the
+ * file holds the key and the start times of the occurrences.
+ *
+ * Created: 16 Oct 2026
+ */
+
+#ifndef EXPCACHE_H
+#define EXPCACHE_H
+
+#include <libical/ical.h>
+
+#define EXPCACHE_MAX_AGE 30	/* Default days to keep unused entries */
+
+typedef struct _expcache {
+  const char *dir;		/* Directory with the cache files */
+  unsigned long hits, misses;	/* Statistics of expcache_load() */
+} expcache;
+
+/* expcache_init -- use (and create, if needed) directory dir as cache */
+extern int expcache_init(expcache *c, const char *dir);
+
+/* expcache_key -- make the cache key of a recurring event in a period
+ *
+ * The key includes all RRULEs, RDATEs and EXDATEs of the event.
+ * Returns a malloc'ed string or NULL if out of memory. Uses libical's
+ * ring buffer, so call it from the main thread only. */
+extern char *expcache_key(icalcomponent *ev,
+			  const struct icaltimetype dtstart,
+			  const struct icaldurationtype dur,
+			  const struct icaltimetype periodstart,
+			  const struct icaltimetype periodend);
+
+/* expcache_load -- look up the occurrences stored under key
+ *
+ * Returns the number of occurrences, or -1 if there is no (valid)
+ * entry. The times are copies of tmpl with the date and time set, in
+ * a malloc'ed array *times. Updates the hit and miss counts. */
+extern int expcache_load(expcache *c, const char *key,
+			 const struct icaltimetype tmpl,
+			 struct icaltimetype **times);
+
+/* expcache_prune -- remove entries that weren't used for days days
+ *
+ * Loading an entry marks it as used. Looks at the directory at most
+ * once a day, the time of the last look is that of a file "pruned" in
+ * it. Returns the number of entries removed, or -1 on error. */
+extern int expcache_prune(const expcache *c, int days);
+
+/* expcache_store -- store n occurrences under key
+ *
+ * Failures are ignored, the next run will simply miss. Safe to call
+ * from several threads. */
+extern void expcache_store(const expcache *c, const char *key,
+			   const struct icaltimetype *times, int n);
+
+#endif /* EXPCACHE_H */
@@ -6,6 +6,26 @@
  *
  *     export TZ=Europe/Paris
  *
+ * With --batch=FILE, many pages are made in one run. Each line of FILE
+ * holds the options and arguments for one page, as on the command line
+ * (words may be quoted with "), and must have an --output. Empty lines
+ * and lines starting with # are ignored. Every input file is parsed
+ * only once, however many pages it is used for.
+ *
+ * With --serve=SOCKET file..., ical2html keeps running and makes pages
+ * of the given files on request. SOCKET is a port number, to serve HTTP
+ * on localhost, or the path of a Unix socket. A request over a Unix
+ * socket is one line with the start, duration and file of the page and
+ * options that only change what is shown (not --output, --cache, etc.),
+ * and the reply is the page or a line starting with "Error:". Over HTTP,
+ * the line is the URL-encoded query: GET /?-m+20261001+P8W+/path/to/
+ * calendar.ics. The files are parsed once and kept, until their
+ * modification time changes. Options of the server itself, such as
+ * --cache, apply to all pages. Without --cache, the server keeps the
+ * occurrences of recurring events in a new directory in $TMPDIR, as
+ * each page is made by a new process, which would otherwise compute
+ * them again.
+ *
  * Author: Bert Bos <bert@w3.org>
  * Created: 22 Sep 2002
  */
@@ -18,9 +38,27 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <getopt.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/file.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <signal.h>
 #include <ctype.h>
+#include <limits.h>
 #include <libical/ical.h>
+#include "outbuf.h"
+#include "calstream.h"
+#include "eventq.h"
+#include "expand.h"
+#include "evfilter.h"
+#include "stats.h"
+#include "words.h"
 /*
 #include <icaltime.h>
 #include <icalcomponent.h>
@@ -29,18 +67,24 @@
 #include <icaltimezone.h>
 */
 
-#define INC 20			/* Used for realloc() */
-
 #define ERR_OUT_OF_MEM 1	/* Program exit codes */
 #define ERR_USAGE 2
 #define ERR_DATE 3
 #define ERR_PARSE 4
+#define ERR_FILEIO 5
 
 #define USAGE "Usage: ical2html [options] start duration [file]\n\
+       ical2html [-j N] --batch=FILE\n\
+       ical2html [--cache=DIR] --serve=SOCKET file...\n\
   -p, --class=CLASS            only (PUBLIC, CONFIDENTIAL, PRIVATE, NONE)\n\
   -P, --not-class=CLASS        exclude (PUBLIC, CONFIDENTIAL, PRIVATE, NONE)\n\
   -c, --category=CATEGORY      only events of this category\n\
   -C, --not-category=CATEGORY  exclude events of this category\n\
+  -A, --after=DATE             only events starting at or after DATE\n\
+                               (of recurring events, each instance)\n\
+  -B, --before=DATE            only events starting before DATE\n\
+  -U, --summary=TEXT           only events with TEXT in their summary\n\
+  (all but dates may be repeated to give several)\n\
   -d, --description            include event's long description in a <PRE>\n\
   -l, --location               include event's location in that <PRE>\n\
   -t, --title=TEXT             use text for HTML title\n\
@@ -48,6 +92,18 @@
   -T, --today                  mark current day with #today in HTML file\n\
   -z, --timezone=country/city  adjust for this timezone (default: GMT)\n\
   -m, --monday                 draw Monday as first week day (Sunday is default)\n\
+  -s, --stream                 handle events while reading (saves memory)\n\
+  -j, --jobs=N                 expand recurring events with N threads\n\
+  -F, --fd=N                   write the HTML to file descriptor N (default: 1)\n\
+  -k, --cache=DIR              keep expanded recurring events in directory DIR\n\
+  -K, --cache-stats            print cache hits and misses to stderr\n\
+      --cache-max-age=DAYS     remove cache entries unused for DAYS (30)\n\
+  -r, --fragments=DIR          keep month tables in DIR, render only changed ones\n\
+  -o, --output=FILE            write the HTML to FILE instead of standard output\n\
+  -b, --batch=FILE             make the pages listed in FILE, N at a time\n\
+  -S, --serve=SOCKET           make pages on request, SOCKET is port or path\n\
+                               (caches occurrences in $TMPDIR if no --cache)\n\
+      --stats[=json]           print times and counts of each page to stderr\n\
   start is of the form yyyymmdd, e.g., 20020927 (27 Sep 2002)\n\
   duration is in days or weeks, e.g., P5W (5 weeks) or P60D (60 days)\n\
   file is an iCalendar file, default is standard input\n"
@@ -58,6 +114,9 @@ static struct option options[] = {
   {"not-class", 1, 0, 'P'},
   {"category", 1, 0, 'c'},
   {"not-category", 1, 0, 'C'},
+  {"after", 1, 0, 'A'},
+  {"before", 1, 0, 'B'},
+  {"summary", 1, 0, 'U'},
   {"description", 0, 0, 'd'},
   {"location", 0, 0, 'l'},
   {"title", 1, 0, 't'},
@@ -65,26 +124,57 @@ static struct option options[] = {
   {"today", 0, 0, 'T'},
   {"timezone", 1, 0, 'z'},
   {"monday", 0, 0, 'm'},
+  {"stream", 0, 0, 's'},
+  {"jobs", 1, 0, 'j'},
+  {"fd", 1, 0, 'F'},
+  {"cache", 1, 0, 'k'},
+  {"cache-stats", 0, 0, 'K'},
+  {"cache-max-age", 1, 0, 'Y'},
+  {"fragments", 1, 0, 'r'},
+  {"output", 1, 0, 'o'},
+  {"batch", 1, 0, 'b'},
+  {"serve", 1, 0, 'S'},
+  {"stats", 2, 0, 'X'},
   {0, 0, 0, 0}
 };
 
-#define OPTIONS "dlmTp:P:c:C:f:z:"
+#define OPTIONS "dlmsTKp:P:c:C:A:B:U:f:z:j:F:k:r:o:b:S:"
+
+#define MAX_WORDS 100		/* Max. number of words on a line of a batch */
+#define MAX_REQUEST 8192	/* Max. length of a request to the server */
+#define REQUEST_TIMEOUT 10	/* Seconds to wait for a client's request */
+#define REQUEST_OPTIONS "pPcCUABdltfTzm" /* Options a request may have */
+
+/* What to render, from the command line or from a line of a batch */
+typedef struct _page {
+  const char *input;		/* iCalendar file, NULL for stdin */
+  const char *output;		/* HTML file, NULL to write to fd */
+  int fd;
+  struct icaltimetype periodstart;
+  struct icaldurationtype duration;
+  const char *title, *footer;
+  evfilter filter;		/* Which events to show */
+  int do_description, do_location, do_today, starts_on_monday;
+  int streaming, nthreads, do_cache_stats;
+  int cache_max_age;		/* Days, 0 to keep the cache entries */
+  icaltimezone *tz;
+  const char *cachedir, *fragdir;
+  const char *batch;		/* Batch file, or NULL */
+  const char *serve;		/* Socket to serve on, or NULL */
+  stats_format stats;		/* Whether and how to print statistics */
+} page;
+
+/* An input file parsed by the server */
+typedef struct _loaded {
+  const char *path;
+  struct stat st;		/* To see if the file changed */
+  icalcomponent *cal;
+} loaded;
 
 static const char *months[] = {"", "January", "February", "March", "April",
 			       "May", "June", "July", "August", "September",
 			       "October", "November", "December"};
 
-/* Structure for storing applicable events */
-typedef struct _event_item {
-  struct icaltimetype start;
-  struct icaltimetype end;
-  const char *uid;
-  struct icaltimetype recur_time;
-  icalcomponent *event;
-} event_item;
-
-static event_item *events = NULL;
-static int nrevents = 0;
 
 
 /* fatal -- print error message and exit with errcode */
@@ -98,84 +188,43 @@ static void fatal(int errcode, const char *message,...)
 }
 
 
-/* compare_events -- compare two event_items (for qsort) */
-static int compare_events(const void *aa, const void *bb)
+/* day_of_week -- day of the week of a day number, 1 = Sunday */
+static int day_of_week(long dn)
 {
-  event_item *a = (event_item *)aa;
-  event_item *b = (event_item *)bb;
-  int h;
-
-  h = icaltime_compare(a->start, b->start);
-  if (h == 0) h = icaltime_compare(a->end, b->end);
-  if (h == 0) h = strcmp(a->uid, b->uid);
-  if (h == 0) h = icaltime_compare(a->recur_time, b->recur_time);
-  return h;
-}
-
-
-/* read_stream -- read size bytes into s from stream d */
-static char* read_stream(char *s, size_t size, void *d)  
-{  
-  return fgets(s, size, (FILE*)d); 
-} 
-
-
-/* print_escaped -- printf with <, >, & and " escaped */
-static void print_escaped(const char *s)
-{
-  const char *t;
-
-  for (t = s; *t; t++) 
-    switch (*t) {
-    case '<': printf("&lt;"); break;
-    case '>': printf("&gt;"); break;
-    case '&': printf("&amp;"); break;
-    default: putchar(*t);
-    }
+  return (int)(((dn + 4) % 7 + 7) % 7) + 1;	/* 1 Jan 1970 was a Thursday */
 }
 
 
 /* print_header -- print boilerplate at start of output */
-static void print_header(struct icaltimetype start, struct icaldurationtype dur,
-			 const char *title)
+static void print_header(outbuf *out, struct icaltimetype start,
+			 struct icaldurationtype dur, const char *title)
 {
   struct icaltimetype end = icaltime_add(start, dur);
 
-  printf("<!DOCTYPE HTML>\n");
-  printf("<html>\n");
-  printf("<head>\n");
-  printf("<meta charset=\"UTF-8\" />\n");
-  printf("<title>");
+  outbuf_puts(out, "<!DOCTYPE HTML>\n");
+  outbuf_puts(out, "<html>\n");
+  outbuf_puts(out, "<head>\n");
+  outbuf_puts(out, "<meta charset=\"UTF-8\" />\n");
+  outbuf_puts(out, "<title>");
   if (title)
-    print_escaped(title);
+    outbuf_escaped(out, title);
   else
-    printf("Calendar %d %s %d - %d %s %d",
-	   start.day, months[start.month], start.year,
-	   end.day, months[end.month], end.year);
-  printf("</title>\n");
-  printf("<link rel=\"stylesheet\" type=\"text/css\" href=\"calendar.css\" />\n");
-  printf("</head>\n");
-  printf("<body>\n");
+    outbuf_printf(out, "Calendar %d %s %d - %d %s %d",
+		  start.day, months[start.month], start.year,
+		  end.day, months[end.month], end.year);
+  outbuf_puts(out, "</title>\n");
+  outbuf_puts(out, "<link rel=\"stylesheet\" type=\"text/css\" href=\"calendar.css\" />\n");
+  outbuf_puts(out, "</head>\n");
+  outbuf_puts(out, "<body>\n");
 }
 
 
 /* print_footer -- print boilerplate at end of output */
-static void print_footer(const char *footer)
+static void print_footer(outbuf *out, const char *footer)
 {
-  if (footer) printf("%s\n", footer);
-  printf("</body>\n");
-  printf("</html>\n");
-}
-
-
-/* print_as_one_word -- replace non-alphanumeric characters by dashes */
-static void print_as_one_word(const char *s)
-{
-  const char *t;
-
-  for (t = s; *t; t++)
-    if (isalnum(*t)) putchar(*t);
-    else putchar('-');
+  if (footer) {outbuf_puts(out, footer); outbuf_puts(out, "\n");}
+  outbuf_puts(out, "</body>\n");
+  outbuf_puts(out, "</html>\n");
 }
 
 
@@ -199,45 +248,47 @@ static void print_attribute(const char *s)
 
 
 /* print_event -- print HTML paragraph for one event */
-static void print_event(const event_item ev, const int do_description, const int do_location)
+static void print_event(outbuf *out, const event_item ev,
+			const int do_description, const int do_location)
 {
-  icaltimezone *utc = icaltimezone_get_utc_timezone();
   icaltimetype start_utc, end_utc;
   icalproperty *p, *desc, *loc;
   enum icalproperty_status status;
   int first;
 
   status = icalcomponent_get_status(ev.event);
-  printf("<div class=\"vevent");
-  if (status)
-    printf(" %s", icalproperty_status_to_string(status));
-  printf("\"><div class=\"");
+  outbuf_puts(out, "<div class=\"vevent");
+  if (status) {
+    outbuf_puts(out, " ");
+    outbuf_puts(out, icalproperty_status_to_string(status));
+  }
+  outbuf_puts(out, "\"><div class=\"");
 
   /* Add all categories to the class attribute */
   first = 1;
   p = icalcomponent_get_first_property(ev.event, ICAL_CATEGORIES_PROPERTY);
   while (p) {
-    if (first) first = 0; else printf(" ");
-    print_as_one_word(icalproperty_get_categories(p));
+    if (first) first = 0; else outbuf_puts(out, " ");
+    outbuf_one_word(out, icalproperty_get_categories(p));
     p = icalcomponent_get_next_property(ev.event, ICAL_CATEGORIES_PROPERTY);
   }
-  printf("\">\n<span class=\"categories\">");
+  outbuf_puts(out, "\">\n<span class=\"categories\">");
 
   /* Also add all categories as content */
   first = 1;
   p = icalcomponent_get_first_property(ev.event, ICAL_CATEGORIES_PROPERTY);
   while (p) {
-    if (first) first = 0; else printf(", ");
-    print_as_one_word(icalproperty_get_categories(p));
+    if (first) first = 0; else outbuf_puts(out, ", ");
+    outbuf_one_word(out, icalproperty_get_categories(p));
     p = icalcomponent_get_next_property(ev.event, ICAL_CATEGORIES_PROPERTY);
   }
-  printf("</span>\n");
+  outbuf_puts(out, "</span>\n");
 
-  /* If there is a time, print it */
-  start_utc = icaltime_convert_to_zone(ev.start, utc);
-  end_utc = icaltime_convert_to_zone(ev.end, utc);
+  /* If there is a time, print it, in UTC as computed for sorting */
+  start_utc = eventq_key_time(ev.start_key);
+  end_utc = eventq_key_time(ev.end_key);
   if (ev.start.hour || ev.start.minute || ev.end.hour || ev.end.minute)
-    printf("<span class=\"time\"><abbr class=\"dtstart\"\n\
+    outbuf_printf(out, "<span class=\"time\"><abbr class=\"dtstart\"\n\
 title=\"%04d%02d%02dT%02d%02d%02dZ\">%02d:%02d</abbr>-<abbr class=\"dtend\"\n\
 title=\"%04d%02d%02dT%02d%02d%02dZ\">%02d:%02d</abbr></span>\n",
 	   start_utc.year, start_utc.month, start_utc.day, start_utc.hour,
@@ -247,16 +298,16 @@ title=\"%04d%02d%02dT%02d%02d%02dZ\">%02d:%02d</abbr></span>\n",
 	   end_utc.minute, end_utc.second,
 	   ev.end.hour, ev.end.minute);
   else
-    printf("<span class=\"notime\"><abbr class=\"dtstart\"\n\
+    outbuf_printf(out, "<span class=\"notime\"><abbr class=\"dtstart\"\n\
 title=\"%04d%02d%02d\">(whole</abbr> <abbr class=\"duration\"\n\
 title=\"1D\">day)</abbr></span>\n", start_utc.year, start_utc.month,
 	   start_utc.day);
 
   /* Print the summary */
-  printf("<span class=\"summary\">");
+  outbuf_puts(out, "<span class=\"summary\">");
   p = icalcomponent_get_first_property(ev.event, ICAL_SUMMARY_PROPERTY);
-  if (p) print_escaped(icalproperty_get_summary(p));
-  printf("</span>\n");
+  if (p) outbuf_escaped(out, icalproperty_get_summary(p));
+  outbuf_puts(out, "</span>\n");
 
   /* If we want descriptions, check if there is one */
   if (do_description)
@@ -271,334 +322,940 @@ title=\"1D\">day)</abbr></span>\n", start_utc.year, start_utc.month,
     loc = NULL;
 
   /* If we have a description and/or location, print them */
-  if (desc || loc) printf("<pre>");
+  if (desc || loc) outbuf_puts(out, "<pre>");
   if (desc) {
-    printf("<span class=\"description\">");
-    print_escaped(icalproperty_get_description(desc));
-    printf("</span>");
+    outbuf_puts(out, "<span class=\"description\">");
+    outbuf_escaped(out, icalproperty_get_description(desc));
+    outbuf_puts(out, "</span>");
   }
-  if (desc && loc) printf("\n");
+  if (desc && loc) outbuf_puts(out, "\n");
   if (loc) {
-    printf("<b class=\"location\">");
-    print_escaped(icalproperty_get_description(loc));
-    printf("</b>");
+    outbuf_puts(out, "<b class=\"location\">");
+    outbuf_escaped(out, icalproperty_get_description(loc));
+    outbuf_puts(out, "</b>");
   }
-  if (desc || loc) printf("</pre>\n");
+  if (desc || loc) outbuf_puts(out, "</pre>\n");
 
-  printf("</div></div>\n\n");
+  outbuf_puts(out, "</div></div>\n\n");
 }
 
 
-/* print_calendar -- print monthly calendars with events */
-static void print_calendar(const struct icaltimetype start,
-			   const struct icaldurationtype duration,
-			   const int nrevents, const event_item events[],
-			   const int do_description, const int do_location,
-			   const int starts_on_monday,
-			   const int do_today, const struct icaltimetype now)
+/* shown_days -- number of days in the months of the period, and the first */
+static int shown_days(const struct icaltimetype start,
+		      const struct icaldurationtype duration, long *day0)
 {
-  struct icaltimetype day;
-  struct icaltimetype end;
-  char s[9];
-  int y, m, d, w;
-  int i = 0;	/* Loop over events */
-  int skip;	/* How many days to skip of that week until 1st */
-  int lastDay;
-  if (starts_on_monday) lastDay = 2; else lastDay = 1;
+  struct icaltimetype end = icaltime_add(start, duration);
 
-  end = icaltime_add(start, duration);
+  *day0 = eventq_day_number(start.year, start.month, 1);
+  return eventq_day_number(end.year, end.month,
+			   icaltime_days_in_month(end.month, end.year))
+    - *day0 + 1;
+}
 
-  /* Loop over the years in our period */
-  for (y = start.year; y <= end.year; y++) {
 
-    /* Loop over the months in this year */
-    for (m = (y == start.year ? start.month : 1);
-	 m <= (y == end.year ? end.month : 12); m++) {
+/* print_month -- print the calendar of one month with its events
+ *
+ * k is the index in first[] of the 1st of the month. */
+static void print_month(outbuf *out, const int y, const int m,
+			const event_item events[], const int first[], int k,
+			const int do_description, const int do_location,
+			const int starts_on_monday, const long today)
+{
+  int d, w;
+  int i;	/* Loop over events */
+  long dn;	/* Day number of the current day */
+  int skip;	/* How many days to skip of that week until 1st */
+  int lastDay;
+  if (starts_on_monday) lastDay = 2; else lastDay = 1;
 
-      /* Is there a more efficient way to set day than via a string? */
-      sprintf(s, "%04d%02d01", y, m);
-      day = icaltime_from_string(s);
+  dn = eventq_day_number(y, m, 1);
 
-      printf("<table><caption>%s %d</caption>\n", months[m], y);
-      printf("<thead><tr>\n");
-      if (starts_on_monday) {
-         printf("<th>Monday</th><th>Tuesday</th><th>Wednesday</th>");
-         printf("<th>Thursday</th><th>Friday</th><th>Saturday</th>");
-         printf("<th>Sunday</th>\n");
-      }
-      else {
-         printf("<th>Sunday</th><th>Monday</th><th>Tuesday</th>");
-         printf("<th>Wednesday</th><th>Thursday</th><th>Friday</th>");
-         printf("<th>Saturday</th>\n");
+  outbuf_printf(out, "<table><caption>%s %d</caption>\n", months[m], y);
+  outbuf_puts(out, "<thead><tr>\n");
+  if (starts_on_monday) {
+     outbuf_puts(out, "<th>Monday</th><th>Tuesday</th><th>Wednesday</th>");
+     outbuf_puts(out, "<th>Thursday</th><th>Friday</th><th>Saturday</th>");
+     outbuf_puts(out, "<th>Sunday</th>\n");
+  }
+  else {
+     outbuf_puts(out, "<th>Sunday</th><th>Monday</th><th>Tuesday</th>");
+     outbuf_puts(out, "<th>Wednesday</th><th>Thursday</th><th>Friday</th>");
+     outbuf_puts(out, "<th>Saturday</th>\n");
 
-      }
-      printf("</tr></thead>\n");
-      printf("<tbody><tr>\n");
+  }
+  outbuf_puts(out, "</tr></thead>\n");
+  outbuf_puts(out, "<tbody><tr>\n");
 
-      w = icaltime_day_of_week(day);
-      if (starts_on_monday)
-         if (w == 1) skip = 6; else skip = w-2;
-      else
-         skip = w-1;
+  w = day_of_week(dn);
+  if (starts_on_monday)
+     if (w == 1) skip = 6; else skip = w-2;
+  else
+     skip = w-1;
 
-      if (skip != 0) {
-         for(; skip > 0; skip--) printf("<td class=\"skip\">&nbsp;</td>\n");
-      }
+  if (skip != 0) {
+     for(; skip > 0; skip--) outbuf_puts(out, "<td class=\"skip\">&nbsp;</td>\n");
+  }
 
-      /* Skip events before this day (can only occur at very start) */
-      for (; i < nrevents
-	     && icaltime_compare_date_only(events[i].start, day) < 0; i++) ;
-
-      /* Loop over the days in this month */
-      for (d = 1; d <= icaltime_days_in_month(m, y); d++) {
-
-	sprintf(s, "%04d%02d%02d", y, m, d);
-	day = icaltime_from_string(s);
-	w = icaltime_day_of_week(day);
-	if (w == lastDay && d != 1)
-	{
-		printf("</tr><tr>\n");
-	}
-
-	printf("<td");
-	if (do_today && icaltime_compare_date_only(day, now) == 0)
-	  printf(" id=\"today\"");
-	printf("><p class=\"date\">%d</p>\n\n", d);
-
-	/* Print all events on this day (the events are sorted) */
-	for (; i < nrevents
-	       && icaltime_compare_date_only(events[i].start, day) == 0; i++)
-		print_event(events[i], do_description, do_location);
-	printf("</td>\n");
-      }
+  /* Loop over the days in this month */
+  for (d = 1; d <= icaltime_days_in_month(m, y); d++, dn++, k++) {
 
-      printf("</tr></tbody></table>\n\n");
+    w = day_of_week(dn);
+    if (w == lastDay && d != 1)
+    {
+	    outbuf_puts(out, "</tr><tr>\n");
     }
 
+    outbuf_puts(out, "<td");
+    if (dn == today)
+      outbuf_puts(out, " id=\"today\"");
+    outbuf_printf(out, "><p class=\"date\">%d</p>\n\n", d);
+
+    /* Print all events on this day (each day is sorted) */
+    for (i = first[k]; i < first[k+1]; i++)
+	    print_event(out, events[i], do_description, do_location);
+    outbuf_puts(out, "</td>\n");
   }
+
+  outbuf_puts(out, "</tr></tbody></table>\n\n");
 }
 
 
-/* add_to_queue -- add event to global queue of events to print */
-static void add_to_queue(icalcomponent *ev, const struct icaltimetype start,
-			 const struct icaltimetype end,
-			 icaltimezone *tz)
+/* hash_string -- add a string (or NULL) to an FNV-1a hash */
+static unsigned long long hash_string(unsigned long long h, const char *s)
 {
-  int n = (nrevents/INC + 1) * INC;
-  struct icaltimetype recur_time = icalcomponent_get_recurrenceid(ev);
+  if (s) for (; *s; s++) h = (h ^ (unsigned char)*s) * 1099511628211ULL;
+  return (h ^ 0xff) * 1099511628211ULL;	/* Separator, not valid UTF-8 */
+}
 
-  if (!(events = realloc(events, n * sizeof(*events))))
-    fatal(ERR_OUT_OF_MEM, "Out of memory\n");
 
+/* hash_number -- add a number to an FNV-1a hash */
+static unsigned long long hash_number(unsigned long long h, long long n)
+{
+  char buf[24];
 
-  events[nrevents].start = icaltime_convert_to_zone(start, tz);
-  events[nrevents].end = icaltime_convert_to_zone(end, tz);
-  events[nrevents].uid = icalcomponent_get_uid(ev);
-  events[nrevents].recur_time = icaltime_convert_to_zone(recur_time, tz);
-  events[nrevents].event = ev;
-  nrevents++;
+  sprintf(buf, "%lld", n);
+  return hash_string(h, buf);
 }
 
-/* filter_queue_recurring -- remove obsolete recurring events from queue */
-static void filter_queue_recurring(void)
+
+/* hash_text -- add what print_event() prints of an event's properties */
+static unsigned long long hash_text(unsigned long long h, icalcomponent *ev,
+				    const int do_description,
+				    const int do_location)
 {
-  int i, j = 0;
+  icalproperty *p;
 
-  for (i = 0; i < nrevents; i++) {
-    if (i < nrevents-1 &&
-	strcmp(events[i].uid, events[i+1].uid) == 0 &&
-	icaltime_compare(events[i].start, events[i+1].start) == 0 &&
-	icaltime_is_null_time(events[i].recur_time) &&
-	!icaltime_is_null_time(events[i+1].recur_time))
-      continue;
-    events[j++] = events[i];
+  h = hash_number(h, icalcomponent_get_status(ev));
+  p = icalcomponent_get_first_property(ev, ICAL_CATEGORIES_PROPERTY);
+  for (; p; p = icalcomponent_get_next_property(ev, ICAL_CATEGORIES_PROPERTY))
+    h = hash_string(h, icalproperty_get_categories(p));
+  p = icalcomponent_get_first_property(ev, ICAL_SUMMARY_PROPERTY);
+  h = hash_string(h, p ? icalproperty_get_summary(p) : NULL);
+  if (do_description) {
+    p = icalcomponent_get_first_property(ev, ICAL_DESCRIPTION_PROPERTY);
+    h = hash_string(h, p ? icalproperty_get_description(p) : NULL);
   }
-  nrevents = j;
+  if (do_location) {
+    p = icalcomponent_get_first_property(ev, ICAL_LOCATION_PROPERTY);
+    h = hash_string(h, p ? icalproperty_get_description(p) : NULL);
+  }
+  return h;
 }
 
 
-/* iterate -- process each component in the collection */
-static void iterate(icalcomponent *c, struct icaltimetype periodstart,
-		    struct icaldurationtype duration,
-		    const char *classmask, const char *categorymask,
-		    const char *notclassmask, const char *notcategorymask,
-		    icaltimezone *tz)
+/* month_hash -- hash of everything that print_month() prints
+ *
+ * An event is identified by its UID, SEQUENCE and LAST-MODIFIED, which
+ * change whenever a producer changes it. Only events without a
+ * LAST-MODIFIED have the text of their properties hashed. */
+static unsigned long long month_hash(const int y, const int m,
+				     const event_item events[],
+				     const int first[], const int k,
+				     const int do_description,
+				     const int do_location,
+				     const int starts_on_monday,
+				     const long today)
 {
-  const struct icaldurationtype one = {0, 1, 0, 0, 0, 0};
-  struct icaltimetype periodend, dtstart, dtend, next, nextend, d;
-  icalcomponent *h; 
+  unsigned long long h = 14695981039346656037ULL;
+  long dn = eventq_day_number(y, m, 1);
+  int nd = icaltime_days_in_month(m, y), d, i;
+  const event_item *ev;
   icalproperty *p;
-  struct icaldurationtype dur;    
-  icalproperty *rrule;
-  struct icalrecurrencetype recur;
-  icalrecur_iterator *ritr;
-  const char *class;
-
-  periodend = icaltime_add(periodstart, duration);
-
-  /* Iterate over VEVENTs */
-  for (h = icalcomponent_get_first_component(c, ICAL_VEVENT_COMPONENT); h;
-       h = icalcomponent_get_next_component(c, ICAL_VEVENT_COMPONENT)) {
-
-    /* Check if the event is of the right class (unless we accept all) */
-    if (classmask || notclassmask) {
-      p = icalcomponent_get_first_property(h, ICAL_CLASS_PROPERTY);
-      class = p ? icalproperty_get_value_as_string(p) : "PUBLIC";
-      if (classmask && strcasecmp(classmask, class) != 0) continue;
-      if (notclassmask && strcasecmp(notclassmask, class) == 0) continue;
-    }
 
-    /* Check if the event is of the right category (unless we accept all) */
-    if (categorymask) {
-      p = icalcomponent_get_first_property(h, ICAL_CATEGORIES_PROPERTY);
-      while (p && strcasecmp(categorymask, icalproperty_get_categories(p)))
-	p = icalcomponent_get_next_property(h, ICAL_CATEGORIES_PROPERTY);
-      if (!p) continue;		/* No category was equal to categorymask */
-    }
-    if (notcategorymask) {
-      p = icalcomponent_get_first_property(h, ICAL_CATEGORIES_PROPERTY);
-      while (p && strcasecmp(notcategorymask, icalproperty_get_categories(p)))
-	p = icalcomponent_get_next_property(h, ICAL_CATEGORIES_PROPERTY);
-      if (p) continue;		/* Some category equal to notcategorymask */
+  h = hash_string(h, VERSION);
+  h = hash_number(h, y);
+  h = hash_number(h, m);
+  h = hash_number(h, do_description);
+  h = hash_number(h, do_location);
+  h = hash_number(h, starts_on_monday);
+  h = hash_number(h, today >= dn && today < dn + nd ? today : 0);
+
+  for (d = 0; d < nd; d++) {
+    h = hash_number(h, first[k+d+1] - first[k+d]);
+    for (i = first[k+d]; i < first[k+d+1]; i++) {
+      ev = &events[i];
+      h = hash_number(h, ev->start_key);
+      h = hash_number(h, ev->end_key);
+      h = hash_number(h, ev->start.year * 10000 + ev->start.month * 100
+		      + ev->start.day);
+      h = hash_number(h, ev->start.hour * 100 + ev->start.minute);
+      h = hash_number(h, ev->end.hour * 100 + ev->end.minute);
+      h = hash_number(h, ev->recur_key);
+      h = hash_string(h, ev->uid);
+      h = hash_number(h, icalcomponent_get_sequence(ev->event));
+      p = icalcomponent_get_first_property(ev->event,
+					   ICAL_LASTMODIFIED_PROPERTY);
+      if (p && ev->uid)
+	h = hash_number(h, eventq_time_key(icalproperty_get_lastmodified(p)));
+      else
+	h = hash_text(h, ev->event, do_description, do_location);
     }
+  }
+  return h;
+}
 
-    /* Get start time and recurrence rule (if any) */
-    dtstart = icalcomponent_get_dtstart(h);
-    rrule = icalcomponent_get_first_property(h, ICAL_RRULE_PROPERTY);
-
-    if (!rrule) {		/* Not recurring */
-
-      /* Check if this event is at least partially within our period */
-      if (icaltime_compare(dtstart, periodend) <= 0) {
-	dtend = icalcomponent_get_dtend(h);
-	if (dtend.year + dtend.month + dtend.day + dtend.hour + dtend.minute +
-	    dtend.second == 0) dtend = dtstart;
-	if (icaltime_compare(periodstart, dtend) <= 0) {
-
-	  /* Add to as many days as it spans */
-	  d = dtstart;
-	  do {
-	    add_to_queue(h, d, dtend, tz);
-	    d = icaltime_add(d, one);
-	  } while (icaltime_compare(d, dtend) < 0);
-	}
-      }
 
-    } else {			/* Recurring event */
-
-      if (icaltime_compare(dtstart, periodend) <= 0) {
-      
-	/* Iterate to find occurrences within our period */
-	dur = icalcomponent_get_duration(h);
-	recur = icalproperty_get_rrule(rrule);
-	ritr = icalrecur_iterator_new(recur, dtstart);
-	while (next = icalrecur_iterator_next(ritr),
-	       !icaltime_is_null_time(next)
-	       && icaltime_compare(next, periodend) <= 0) {
-
-	  nextend = icaltime_add(next, dur);
-	  if (icaltime_compare(nextend, periodstart) >= 0)
-	    add_to_queue(h, next, nextend, tz);
-	}
-
-	/* Clean up */
-	icalrecur_iterator_free(ritr);
-      }
+/* copy_file -- copy the contents of a file to out, return -1 on error
+ *
+ * The file is read completely before anything is written, so that out
+ * is unchanged if reading fails halfway and the caller can fall back
+ * to rendering the month instead. */
+static int copy_file(outbuf *out, const char *path)
+{
+  struct stat st;
+  char *buf = NULL, *h;
+  size_t len = 0, size;
+  ssize_t n = 0;
+  int fd;
+
+  if ((fd = open(path, O_RDONLY)) < 0) return -1;
+  size = fstat(fd, &st) == 0 && st.st_size > 0 ? st.st_size + 1 : OUTBUF_SIZE;
+  do {
+    if (len == size || !buf) {	/* Grown since fstat(), or first time */
+      if (buf) size *= 2;
+      if (!(h = realloc(buf, size))) fatal(ERR_OUT_OF_MEM, "Out of memory\n");
+      buf = h;
     }
+    n = read(fd, buf + len, size - len);
+    if (n > 0) len += n;
+  } while (n > 0 || (n < 0 && errno == EINTR));
+  close(fd);
+  if (n == 0) outbuf_write(out, buf, len);
+  free(buf);
+  return n < 0 ? -1 : 0;
+}
+
+
+/* create_temp -- create a file that will later be renamed to path */
+static int create_temp(const char *path, char *tmp, size_t size)
+{
+  mode_t mask;
+  int fd;
+
+  snprintf(tmp, size, "%s.XXXXXX", path);
+  if ((fd = mkstemp(tmp)) < 0)
+    fatal(ERR_FILEIO, "%s: %s\n", tmp, strerror(errno));
+
+  /* mkstemp() makes it private, give it the usual permissions */
+  mask = umask(0);
+  umask(mask);
+  (void) fchmod(fd, 0666 & ~mask);
+  return fd;
+}
+
+
+/* write_fragment -- replace a file by the output of print_month() */
+static void write_fragment(const char *path, const int y, const int m,
+			   const event_item events[], const int first[],
+			   const int k, const int do_description,
+			   const int do_location, const int starts_on_monday,
+			   const long today)
+{
+  static outbuf frag;
+  char tmp[4096];
+  int fd;
+
+  fd = create_temp(path, tmp, sizeof(tmp));
+  outbuf_init(&frag, fd);
+  print_month(&frag, y, m, events, first, k, do_description, do_location,
+	      starts_on_monday, today);
+  if (outbuf_flush(&frag) != 0 || close(fd) != 0 || rename(tmp, path) != 0)
+    fatal(ERR_FILEIO, "%s: %s\n", path, strerror(errno));
+}
+
+
+/* print_fragment -- print a month, from its fragment file if unchanged
+ *
+ * The fragment DIR/yyyy-mm.html holds the month's table and
+ * DIR/yyyy-mm.hash the month_hash() of its contents. The hash file is
+ * removed before the fragment is replaced and both are written to a
+ * temporary file first, so a crash can only cause the fragment to be
+ * rendered again. Pages that share DIR may be made at the same time,
+ * so the month is locked (with flock() on DIR/yyyy-mm.lock) from
+ * checking the hash until the fragment is copied. */
+static void print_fragment(outbuf *out, const char *dir, const int y,
+			   const int m, const event_item events[],
+			   const int first[], const int k,
+			   const int do_description, const int do_location,
+			   const int starts_on_monday, const long today)
+{
+  char path[4096], hashpath[4096], lockpath[4096], tmp[4096], buf[24];
+  unsigned long long h, old;
+  FILE *f;
+  int same = 0, fd, lock;
+
+  snprintf(path, sizeof(path), "%s/%04d-%02d.html", dir, y, m);
+  snprintf(hashpath, sizeof(hashpath), "%s/%04d-%02d.hash", dir, y, m);
+  snprintf(lockpath, sizeof(lockpath), "%s/%04d-%02d.lock", dir, y, m);
+  h = month_hash(y, m, events, first, k, do_description, do_location,
+		 starts_on_monday, today);
+
+  if ((lock = open(lockpath, O_RDWR | O_CREAT, 0666)) < 0
+      || flock(lock, LOCK_EX) != 0)
+    fatal(ERR_FILEIO, "%s: %s\n", lockpath, strerror(errno));
+
+  if ((f = fopen(hashpath, "r"))) {
+    same = fscanf(f, "%llx", &old) == 1 && old == h;
+    fclose(f);
   }
+  if (same && copy_file(out, path) == 0) {close(lock); return;}
+
+  /* Changed (or unreadable), render it again */
+  if (unlink(hashpath) != 0 && errno != ENOENT)
+    fatal(ERR_FILEIO, "%s: %s\n", hashpath, strerror(errno));
+  write_fragment(path, y, m, events, first, k, do_description, do_location,
+		 starts_on_monday, today);
+  fd = create_temp(hashpath, tmp, sizeof(tmp));
+  sprintf(buf, "%016llx\n", h);
+  if (write(fd, buf, 17) != 17 || close(fd) != 0 || rename(tmp, hashpath) != 0)
+    fatal(ERR_FILEIO, "%s: %s\n", hashpath, strerror(errno));
+  if (copy_file(out, path) != 0)
+    fatal(ERR_FILEIO, "%s: %s\n", path, strerror(errno));
+  close(lock);			/* Also releases the lock */
 }
 
 
-/* main */
-int main(int argc, char *argv[])
+/* print_calendar -- print monthly calendars with events
+ *
+ * If fragdir is not NULL, the months are kept as fragments in that
+ * directory and only those whose events changed are rendered. */
+static void print_calendar(outbuf *out, const struct icaltimetype start,
+			   const struct icaldurationtype duration,
+			   const event_item events[], const int first[],
+			   const int do_description, const int do_location,
+			   const int starts_on_monday,
+			   const int do_today, const struct icaltimetype now,
+			   const char *fragdir)
 {
-  FILE* stream;
-  icalcomponent *comp;
-  icalparser *parser;
-  struct icaltimetype periodstart;
-  struct icaldurationtype duration;
-  char *title = NULL, *footer = NULL, *class = NULL, *category = NULL;
-  char *not_class = NULL, *not_category = NULL;
-  char c;
-  int dummy1, dummy2, dummy3, do_description = 0, do_location = 0;
-  int do_today = 0;
-  icaltimezone *tz;
-  struct icaltimetype now;
-  int starts_on_monday = 0;
+  struct icaltimetype end;
+  int y, m;
+  int k = 0;	/* Index of day in first[] */
+  long today;	/* Day number of today, if we mark it */
 
-  /* We handle errors ourselves */
-  icalerror_set_errors_are_fatal(0);
-  icalerror_clear_errno();
+  if (do_today) today = eventq_day_number(now.year, now.month, now.day);
+  else today = LONG_MIN;
 
-  /* icaltimezone_set_tzid_prefix("/kde.org/Olson_20080523_1/"); */
-  /* icaltimezone_set_tzid_prefix(""); */
-  set_zone_directory("/usr/share/apps/libical/zoneinfo/"); /* TO DO */
-  tz = icaltimezone_get_utc_timezone();		/* Default */
+  end = icaltime_add(start, duration);
 
-  /* Read commandline */
+  /* Loop over the years in our period */
+  for (y = start.year; y <= end.year; y++) {
+
+    /* Loop over the months in this year */
+    for (m = (y == start.year ? start.month : 1);
+	 m <= (y == end.year ? end.month : 12); m++) {
+
+      if (fragdir)
+	print_fragment(out, fragdir, y, m, events, first, k, do_description,
+		       do_location, starts_on_monday, today);
+      else
+	print_month(out, y, m, events, first, k, do_description, do_location,
+		    starts_on_monday, today);
+      k += icaltime_days_in_month(m, y);
+    }
+
+  }
+}
+
+
+/* parse_args -- read options and arguments, return 0 or an exit code
+ *
+ * If allowed is not NULL, only the options in it are accepted. */
+static int parse_args(int argc, char *argv[], page *pg, const char *allowed)
+{
+  int c, e = 0, fmt, dummy1, dummy2, dummy3;
+  evfilter *f = &pg->filter;
+  char *end;
+
+  memset(pg, 0, sizeof(*pg));
+  pg->fd = STDOUT_FILENO;
+  pg->nthreads = 1;
+  pg->cache_max_age = EXPCACHE_MAX_AGE;
+  pg->tz = icaltimezone_get_utc_timezone();		/* Default */
+  evfilter_init(&pg->filter, "PUBLIC");
+
+  optind = 0;			/* Start afresh, this may be a new argv */
   while ((c = getopt_long(argc, argv, OPTIONS, options, NULL)) != -1) {
+    if (allowed && !strchr(allowed, c)) return ERR_USAGE;
     switch (c) {
-    case 'p': class = strdup(optarg); break;
-    case 'P': not_class = strdup(optarg); break;
-    case 'c': category = strdup(optarg); break;
-    case 'C': not_category = strdup(optarg); break;
-    case 'd': do_description = 1; break;
-    case 'l': do_location = 1; break;
-    case 't': title = strdup(optarg); break;
-    case 'f': footer = strdup(optarg); break;
-    case 'T': do_today = 1; break;
-    case 'z': tz = icaltimezone_get_builtin_timezone(optarg); break;
-    case 'm': starts_on_monday = 1; break;
-    default: fatal(ERR_USAGE, USAGE);
+    case 'p': e = evfilter_add(f, EVFILTER_CLASS, optarg); break;
+    case 'P': e = evfilter_add(f, EVFILTER_NOT_CLASS, optarg); break;
+    case 'c': e = evfilter_add(f, EVFILTER_CATEGORY, optarg); break;
+    case 'C': e = evfilter_add(f, EVFILTER_NOT_CATEGORY, optarg); break;
+    case 'U': e = evfilter_add(f, EVFILTER_SUMMARY, optarg); break;
+    case 'A': case 'B':
+      if (evfilter_add(f, c == 'A' ? EVFILTER_AFTER : EVFILTER_BEFORE,
+		       optarg) != 0) {
+	fprintf(stderr, "Incorrect date '%s', must be YYYYMMDD.\n", optarg);
+	return ERR_DATE;
+      }
+      break;
+    case 'd': pg->do_description = 1; break;
+    case 'l': pg->do_location = 1; break;
+    case 't': pg->title = optarg; break;
+    case 'f': pg->footer = optarg; break;
+    case 'T': pg->do_today = 1; break;
+    case 'z': pg->tz = icaltimezone_get_builtin_timezone(optarg); break;
+    case 'm': pg->starts_on_monday = 1; break;
+    case 's': pg->streaming = 1; break;
+    case 'j':
+      pg->nthreads = strtol(optarg, &end, 10);
+      if (end == optarg || *end || pg->nthreads < 1) return ERR_USAGE;
+      break;
+    case 'F': pg->fd = atoi(optarg); break;
+    case 'k': pg->cachedir = optarg; break;
+    case 'K': pg->do_cache_stats = 1; break;
+    case 'Y': pg->cache_max_age = atoi(optarg); break;
+    case 'r': pg->fragdir = optarg; break;
+    case 'o': pg->output = optarg; break;
+    case 'b': pg->batch = optarg; break;
+    case 'S': pg->serve = optarg; break;
+    case 'X':
+      if ((fmt = stats_format_from_string(optarg)) < 0) return ERR_USAGE;
+      pg->stats = fmt;
+      break;
+    default: return ERR_USAGE;
     }
+    if (e != 0) fatal(ERR_OUT_OF_MEM, "Out of memory\n");
+  }
+  if (pg->batch) return optind == argc ? 0 : ERR_USAGE;
+  if (pg->serve) return optind < argc ? 0 : ERR_USAGE; /* The files */
+  if (optind == argc) return ERR_USAGE;
+  if (sscanf(argv[optind], "%04d%02d%02d", &dummy1, &dummy2, &dummy3) < 3) {
+    fprintf(stderr, "Incorrect date '%s', must be YYYYMMDD.\n", argv[optind]);
+    return ERR_DATE;
   }
-  if (optind == argc) fatal(ERR_USAGE, USAGE);
-  if (sscanf(argv[optind], "%04d%02d%02d", &dummy1, &dummy2, &dummy3) < 3)
-    fatal(ERR_DATE, "Incorrect date '%s', must be YYYYMMDD.\n", argv[optind]);
-  periodstart = icaltime_from_string(argv[optind]);
+  pg->periodstart = icaltime_from_string(argv[optind]);
   if (icalerrno) ;		/* TO DO */
   optind++;
-  if (optind == argc) fatal(ERR_USAGE, USAGE);
-  duration = icaldurationtype_from_string(argv[optind]);
+  if (optind == argc) return ERR_USAGE;
+  pg->duration = icaldurationtype_from_string(argv[optind]);
   /*
   if (icalerrno)
     fatal(ERR_DATE, "Incorrect duration '%s', must be PnW or PnD.\n", argv[optind]);
   */
   optind++;
-  stream = optind == argc ? stdin : fopen(argv[optind], "r");
-  if (!stream) {perror(argv[optind]); exit(1);}
-  if (optind + 1 < argc) fatal(ERR_USAGE, USAGE);
-  now = icaltime_current_time_with_zone(tz);
+  if (optind < argc) pg->input = argv[optind++];
+  if (optind < argc) return ERR_USAGE;
+  return 0;
+}
 
-  /* Create a new parser object */
-  parser = icalparser_new();
 
-  /* Tell the parser what input stream it should use */
-  icalparser_set_gen_data(parser, stream);
+/* keep_component -- calstream_handler that keeps everything */
+static int keep_component(icalcomponent *comp, void *data)
+{
+  return CALSTREAM_KEEP;
+}
 
-  /* Let the parser read the file and return all components */
-  if (! (comp = icalparser_parse(parser, read_stream)))
-    fatal(ERR_PARSE, "Parse error: %s\n", icalerror_strerror(icalerrno));
 
-  /* Process the resulting list of components */
-  iterate(comp, periodstart, duration,
-	  class, not_class, category, not_category, tz);
+/* render -- find the events for one page and write it
+ *
+ * If cal is NULL, the page's input is parsed (and freed again),
+ * otherwise the events are taken from cal, which was parsed earlier. */
+static void render(const page *pg, icalcomponent *cal)
+{
+  static outbuf out;
+  FILE* stream;
+  icalcomponent *comp = cal;
+  struct icaltimetype now;
+  expcache cache;
+  event_queue queue;
+  selection sel;
+  int *first, ndays, fd = pg->fd;
+  long day0, queued;
+  char tmp[4096];
+  stats st;
+
+  stats_init(&st, "ical2html", pg->stats);
+  if (pg->output) {		/* Tell the pages of a batch apart */
+    stats_label(&st, pg->output);
+  } else {
+    snprintf(tmp, sizeof(tmp), "%s %s %s", pg->input ? pg->input : "-",
+	     icaltime_as_ical_string(pg->periodstart),
+	     icaldurationtype_as_ical_string(pg->duration));
+    stats_label(&st, tmp);
+  }
+  now = icaltime_current_time_with_zone(pg->tz);
+  if (pg->fragdir && mkdir(pg->fragdir, 0777) != 0 && errno != EEXIST)
+    fatal(ERR_FILEIO, "%s: %s\n", pg->fragdir, strerror(errno));
+
+  /* Read the events and queue their occurrences within the period */
+  eventq_init(&queue);
+  expand_init(&sel, &queue, pg->periodstart, pg->duration, pg->tz);
+  sel.filter = &pg->filter;
+  sel.nthreads = pg->nthreads;
+  if (pg->cachedir) {
+    if (expcache_init(&cache, pg->cachedir) != 0)
+      fatal(ERR_FILEIO, "%s: %s\n", pg->cachedir, strerror(errno));
+    sel.cache = &cache;
+  }
+  if (cal) {
+    stats_phase(&st, "expand");
+    expand_calendar(cal, &sel);
+  } else {
+    stream = pg->input ? fopen(pg->input, "r") : stdin;
+    if (!stream) {perror(pg->input); exit(1);}
+    if (pg->streaming) {	/* Parsing and expanding can't be told apart */
+      stats_phase(&st, "parse_expand");
+      comp = calstream_parse(stream, 1, expand_event, &sel);
+    } else {
+      stats_phase(&st, "parse");
+      comp = calstream_parse(stream, 0, keep_component, NULL);
+      stats_phase(&st, "expand");
+      if (comp) expand_calendar(comp, &sel);
+    }
+    if (!comp)
+      fatal(ERR_PARSE, "Parse error: %s\n", icalerror_strerror(icalerrno));
+    if (stream != stdin) fclose(stream);
+  }
+  expand_finish(&sel);
+  queued = queue.n;
+  if (pg->cachedir && pg->do_cache_stats)
+    fprintf(stderr, "Cache: %lu hits, %lu misses\n", cache.hits, cache.misses);
+  if (pg->cachedir && pg->cache_max_age > 0)
+    (void) expcache_prune(&cache, pg->cache_max_age);
+
+  /* Sort the result into days, dropping what we won't print */
+  stats_phase(&st, "sort");
+  ndays = shown_days(pg->periodstart, pg->duration, &day0);
+  if (! (first = eventq_sort_by_day(&queue, day0, ndays)))
+    fatal(ERR_OUT_OF_MEM, "Out of memory\n");
 
-  /* Sort the result */
-  qsort(events, nrevents, sizeof(*events), compare_events);
+  /* Print the sorted results, replace the output file only when done */
+  stats_phase(&st, "print");
+  if (pg->output) fd = create_temp(pg->output, tmp, sizeof(tmp));
+  outbuf_init(&out, fd);
+  print_header(&out, pg->periodstart, pg->duration, pg->title);
+  print_calendar(&out, pg->periodstart, pg->duration, queue.items, first,
+		 pg->do_description, pg->do_location, pg->starts_on_monday,
+		 pg->do_today, now, pg->fragdir);
+  print_footer(&out, pg->footer);
+  if (outbuf_flush(&out) != 0)
+    fatal(ERR_FILEIO, "Cannot write output: %s\n", strerror(errno));
+  if (pg->output && (close(fd) != 0 || rename(tmp, pg->output) != 0))
+    fatal(ERR_FILEIO, "%s: %s\n", pg->output, strerror(errno));
+
+  stats_add(&st, "vevents", sel.seq);
+  stats_add(&st, "vevents_filtered_out", sel.filtered);
+  stats_add(&st, "iterator_steps", sel.steps);
+  stats_add(&st, "occurrences_queued", queued);
+  stats_add(&st, "occurrences_superseded", sel.superseded);
+  if (pg->cachedir) {
+    stats_add(&st, "cache_hits", cache.hits);
+    stats_add(&st, "cache_misses", cache.misses);
+  }
+  stats_add(&st, "html_bytes", out.written);
+  stats_report(&st, stderr);
 
-  /* Filter out (later) updated recurring event occurrences */
-  filter_queue_recurring();
+  /* Clean up */
+  free(first);
+  eventq_free(&queue);
+  if (!cal) icalcomponent_free(comp);
+}
 
-  /* Print the sorted results */
-  print_header(periodstart, duration, title);
-  print_calendar(periodstart, duration, nrevents, events, do_description,
-		 do_location, starts_on_monday, do_today, now);
-  print_footer(footer);
 
-  /* Clean up */
-  icalcomponent_free(comp);
-  icalparser_free(parser); 
+/* read_batch -- read the pages listed in a batch file */
+static page *read_batch(const char *path, int *npages)
+{
+  char *line = NULL, *argv[MAX_WORDS + 1];
+  size_t size = 0;
+  page *pages = NULL;
+  int argc, lineno = 0, n = 0, e;
+  FILE *f;
+
+  if (!(f = fopen(path, "r"))) {perror(path); exit(ERR_FILEIO);}
+  while (getline(&line, &size, f) != -1) {
+    lineno++;
+    if ((argc = split_words(line, argv + 1, MAX_WORDS)) < 0)
+      fatal(ERR_USAGE, "%s:%d: Line too long or unbalanced quotes\n",
+	    path, lineno);
+    if (argc == 0 || argv[1][0] == '#') continue;
+
+    /* The line is a command line, the strings in it stay in use */
+    argv[0] = "ical2html";
+    if (!(pages = realloc(pages, (n + 1) * sizeof(*pages))))
+      fatal(ERR_OUT_OF_MEM, "Out of memory\n");
+    if ((e = parse_args(argc + 1, argv, &pages[n], NULL)) != 0)
+      fatal(e, "%s:%d: Incorrect page\n%s", path, lineno, USAGE);
+    if (pages[n].batch || pages[n].serve)
+      fatal(ERR_USAGE, "%s:%d: Not a page\n", path, lineno);
+    if (!pages[n].output)
+      fatal(ERR_USAGE, "%s:%d: Missing --output\n", path, lineno);
+    n++;
+    line = NULL;
+    size = 0;
+  }
+  free(line);
+  fclose(f);
+  *npages = n;
+  return pages;
+}
+
+
+/* wait_child -- wait for a page to be rendered, return 0 if it went OK */
+static int wait_child(void)
+{
+  int status;
+
+  if (wait(&status) < 0) return ERR_FILEIO;
+  if (WIFEXITED(status)) return WEXITSTATUS(status);
+  return ERR_FILEIO;
+}
+
+
+/* same_input -- check if two pages are made from the same file */
+static int same_input(const page *a, const page *b)
+{
+  if (!a->input || !b->input) return a->input == b->input;
+  return strcmp(a->input, b->input) == 0;
+}
+
+
+/* run_batch -- render all pages of a batch file, nprocs at a time
+ *
+ * Each page is made in a child process, so a page that fails doesn't
+ * stop the others. A page for which no process can be started fails
+ * too. Returns the exit code of the first that failed. */
+static int run_batch(const char *path, int nprocs)
+{
+  int npages, i, j, running = 0, result = 0, e;
+  icalcomponent *cal;
+  page *pages;
+  char *done;
+  FILE *stream;
+  pid_t pid;
+
+  if (nprocs < 1) nprocs = 1;
+  pages = read_batch(path, &npages);
+  if (!(done = calloc(npages, 1))) fatal(ERR_OUT_OF_MEM, "Out of memory\n");
+
+  for (i = 0; i < npages; i++) {
+    if (done[i]) continue;
+
+    /* Parse the input once for all pages that use it */
+    stream = pages[i].input ? fopen(pages[i].input, "r") : stdin;
+    cal = stream ? calstream_parse(stream, 0, keep_component, NULL) : NULL;
+    if (!stream) {
+      perror(pages[i].input);
+      if (!result) result = ERR_FILEIO;
+    } else if (!cal) {
+      fprintf(stderr, "%s: Parse error: %s\n", pages[i].input ?
+	      pages[i].input : "stdin", icalerror_strerror(icalerrno));
+      if (!result) result = ERR_PARSE;
+    }
+    if (stream && stream != stdin) fclose(stream);
+
+    for (j = i; j < npages; j++) {
+      if (done[j] || !same_input(&pages[i], &pages[j])) continue;
+      done[j] = 1;
+      if (!cal) continue;	/* Reported above */
+
+      /* Children share the parsed calendar with us, copy-on-write */
+      while (running >= nprocs) {
+	if ((e = wait_child()) && !result) result = e;
+	running--;
+      }
+      /* If fork() fails, wait for a child to make room and try again,
+       * a fatal() in render() here would end the whole batch */
+      while ((pid = fork()) < 0 && running > 0) {
+	if ((e = wait_child()) && !result) result = e;
+	running--;
+      }
+      if (pid == 0) {render(&pages[j], cal); _exit(0);}
+      if (pid > 0) {
+	running++;
+      } else {
+	fprintf(stderr, "%s: %s\n", pages[j].output, strerror(errno));
+	if (!result) result = ERR_FILEIO;
+      }
+    }
+    if (cal) icalcomponent_free(cal);
+  }
+
+  while (running-- > 0)
+    if ((e = wait_child()) && !result) result = e;
+
+  for (i = 0; i < npages; i++) evfilter_free(&pages[i].filter);
+  free(done);
+  free(pages);
+  return result;
+}
+
+
+/* listen_on -- open a Unix socket or a port on localhost for requests */
+static int listen_on(const char *addr, int *http)
+{
+  struct sockaddr_un un;
+  struct sockaddr_in in;
+  int fd, on = 1;
+
+  *http = addr[0] && strspn(addr, "0123456789") == strlen(addr);
+  if (*http) {
+    memset(&in, 0, sizeof(in));
+    in.sin_family = AF_INET;
+    in.sin_port = htons(atoi(addr));
+    in.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0
+	|| setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) != 0
+	|| bind(fd, (struct sockaddr *)&in, sizeof(in)) != 0)
+      fatal(ERR_FILEIO, "%s: %s\n", addr, strerror(errno));
+  } else {
+    if (strlen(addr) >= sizeof(un.sun_path))
+      fatal(ERR_USAGE, "%s: Socket path too long\n", addr);
+    memset(&un, 0, sizeof(un));
+    un.sun_family = AF_UNIX;
+    strcpy(un.sun_path, addr);
+    (void) unlink(addr);	/* Left over from an earlier run */
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0
+	|| bind(fd, (struct sockaddr *)&un, sizeof(un)) != 0)
+      fatal(ERR_FILEIO, "%s: %s\n", addr, strerror(errno));
+  }
+  if (listen(fd, 64) != 0)
+    fatal(ERR_FILEIO, "%s: %s\n", addr, strerror(errno));
+  return fd;
+}
+
+
+/* read_request -- read a request into buf, return its words or -1 */
+static int read_request(int fd, int http, char *buf, char *words[])
+{
+  size_t len = 0;
+  ssize_t n;
+  char *s, *t, *end;
+  int c;
+
+  /* Read the line, over HTTP also the headers after it */
+  while (len < MAX_REQUEST - 1) {
+    if ((n = read(fd, buf + len, MAX_REQUEST - 1 - len)) <= 0) break;
+    len += n;
+    buf[len] = '\0';
+    if (http ? strstr(buf, "\r\n\r\n") || strstr(buf, "\n\n")
+	: strchr(buf, '\n') != NULL) break;
+  }
+  buf[len] = '\0';
+  if ((end = strchr(buf, '\n'))) *end = '\0';
+  else if (len == MAX_REQUEST - 1) return -1;
+
+  if (http) {
+    /* GET /?query HTTP/1.x, decode the query in place */
+    if (strncmp(buf, "GET /", 5) != 0) return -1;
+    s = buf + 5;
+    if (*s == '?') s++;
+    s[strcspn(s, " \r")] = '\0';
+    for (t = buf; *s; s++)
+      if (*s == '+') *t++ = ' ';
+      else if (*s == '%' && isxdigit((unsigned char)s[1])
+	       && isxdigit((unsigned char)s[2]) && sscanf(s + 1, "%2x", &c)) {
+	*t++ = c;
+	s += 2;
+      } else *t++ = *s;
+    *t = '\0';
+  }
+  return split_words(buf, words + 1, MAX_WORDS);
+}
+
+
+/* reply_error -- tell the client its request failed */
+static void reply_error(int fd, int http, const char *message)
+{
+  char buf[1024];
+  int n;
+
+  if (http)
+    n = snprintf(buf, sizeof(buf), "HTTP/1.0 400 Bad Request\r\n"
+		 "Content-Type: text/plain; charset=UTF-8\r\n\r\n%s\n", message);
+  else
+    n = snprintf(buf, sizeof(buf), "Error: %s\n", message);
+  if (n > sizeof(buf) - 1) n = sizeof(buf) - 1;
+  (void) write(fd, buf, n);
+}
+
+
+/* refresh -- parse the files that are new or changed since last time */
+static void refresh(loaded files[], int nfiles)
+{
+  struct stat st;
+  FILE *stream;
+  loaded *f;
+
+  for (f = files; f < files + nfiles; f++) {
+    if (stat(f->path, &st) == 0 && f->cal && f->st.st_mtime == st.st_mtime
+	&& f->st.st_size == st.st_size && f->st.st_ino == st.st_ino)
+      continue;			/* Unchanged */
+    if (f->cal) icalcomponent_free(f->cal);
+    f->cal = NULL;
+    if (!(stream = fopen(f->path, "r"))) continue;
+    if (fstat(fileno(stream), &f->st) == 0)
+      f->cal = calstream_parse(stream, 0, keep_component, NULL);
+    fclose(stream);
+  }
+}
+
+
+/* reply_fd -- the client of this child, while it has no reply yet */
+static int reply_fd = -1, reply_http;
+
+/* reply_failed -- at exit, tell the client that its page failed */
+static void reply_failed(void)
+{
+  const char *msg = "HTTP/1.0 500 Internal Server Error\r\n"
+    "Content-Type: text/plain; charset=UTF-8\r\n\r\nCannot make the page\n";
+
+  if (reply_fd < 0) return;
+  if (!reply_http) msg = "Error: Cannot make the page\n";
+  (void) write(reply_fd, msg, strlen(msg));
+}
+
+
+/* send_file -- copy file from to the client, return 0 or -1 */
+static int send_file(int from, int to)
+{
+  char buf[OUTBUF_SIZE];
+  ssize_t n, k, done;
+
+  if (lseek(from, 0, SEEK_SET) != 0) return -1;
+  while ((n = read(from, buf, sizeof(buf))) > 0)
+    for (done = 0; done < n; done += k)
+      if ((k = write(to, buf + done, n - done)) < 0) return -1;
+  return n < 0 ? -1 : 0;
+}
+
+
+/* handle -- read one request from the client and send it the page
+ *
+ * Runs in a child of the server. The whole request must arrive within
+ * REQUEST_TIMEOUT seconds. The page is made in a temporary file first,
+ * so the client gets either all of it or an error. */
+static void handle(int fd, int http, const page *server, loaded files[],
+		   int nfiles)
+{
+  char buf[MAX_REQUEST], *words[MAX_WORDS + 1];
+  const char *ok = "HTTP/1.0 200 OK\r\n"
+    "Content-Type: text/html; charset=UTF-8\r\n\r\n";
+  FILE *tmp;
+  int argc, i;
+  page pg;
+
+  alarm(REQUEST_TIMEOUT);	/* Kills us if the client is too slow */
+  words[0] = "ical2html";
+  if ((argc = read_request(fd, http, buf, words)) <= 0
+      || parse_args(argc + 1, words, &pg, REQUEST_OPTIONS) != 0
+      || !pg.input) {
+    reply_error(fd, http, "Incorrect request");
+    return;
+  }
+  alarm(0);
+
+  /* Only the files given to the server */
+  for (i = 0; i < nfiles && strcmp(files[i].path, pg.input) != 0; i++) ;
+  if (i == nfiles) {reply_error(fd, http, "Unknown calendar"); return;}
+  if (!files[i].cal) {
+    reply_error(fd, http, "Cannot read or parse the calendar");
+    return;
+  }
+
+  if (!(tmp = tmpfile())) {reply_error(fd, http, "Server busy"); return;}
+  pg.fd = fileno(tmp);
+  pg.cachedir = server->cachedir;
+  pg.cache_max_age = server->cache_max_age;
+  reply_fd = fd;
+  reply_http = http;
+  atexit(reply_failed);		/* In case render() calls fatal() */
+  render(&pg, files[i].cal);
+  reply_fd = -1;
+  if (http) (void) write(fd, ok, strlen(ok));
+  (void) send_file(pg.fd, fd);
+}
+
+
+/* serve -- make pages of the given files on request, forever
+ *
+ * Each request is read and its page rendered by a child process, which
+ * has the parsed calendars already, so a crashing or slow client or
+ * page doesn't stop the server. The children can't pass the
+ * occurrences they compute back, so they share them through the
+ * server's --cache, or, if there is none, a private directory in
+ * $TMPDIR that is made here (and left behind when the server stops). */
+static void serve(page *server, char *paths[], int nfiles)
+{
+  static char cachedir[4096];
+  const char *tmp;
+  loaded *files;
+  int sock, fd, http, i;
+  pid_t pid;
+
+  if (!server->cachedir) {
+    if (!(tmp = getenv("TMPDIR")) || !*tmp) tmp = "/tmp";
+    snprintf(cachedir, sizeof(cachedir), "%s/ical2html-cache.XXXXXX", tmp);
+    if (!mkdtemp(cachedir))
+      fatal(ERR_FILEIO, "%s: %s\n", cachedir, strerror(errno));
+    server->cachedir = cachedir;
+  }
+
+  if (!(files = calloc(nfiles, sizeof(*files))))
+    fatal(ERR_OUT_OF_MEM, "Out of memory\n");
+  for (i = 0; i < nfiles; i++) files[i].path = paths[i];
+
+  sock = listen_on(server->serve, &http);
+  signal(SIGCHLD, SIG_IGN);	/* No zombies */
+  signal(SIGPIPE, SIG_IGN);	/* Clients may go away */
+
+  for (;;) {
+    if ((fd = accept(sock, NULL, NULL)) < 0) continue;
+    refresh(files, nfiles);
+    if ((pid = fork()) == 0) {
+      close(sock);
+      handle(fd, http, server, files, nfiles);
+      _exit(0);
+    } else if (pid < 0) {
+      reply_error(fd, http, "Server busy");
+    }
+    close(fd);
+  }
+}
+
+
+/* main */
+int main(int argc, char *argv[])
+{
+  page pg;
+  int e;
+
+  /* We handle errors ourselves */
+  icalerror_set_errors_are_fatal(0);
+  icalerror_clear_errno();
+
+  /* icaltimezone_set_tzid_prefix("/kde.org/Olson_20080523_1/"); */
+  /* icaltimezone_set_tzid_prefix(""); */
+  set_zone_directory("/usr/share/apps/libical/zoneinfo/"); /* TO DO */
+
+  /* Read commandline */
+  if ((e = parse_args(argc, argv, &pg, NULL)) == ERR_USAGE) fatal(e, USAGE);
+  else if (e) exit(e);
+
+  /* With a batch file, -j is the number of pages made at the same time */
+  if (pg.batch) return run_batch(pg.batch, pg.nthreads);
+  if (pg.serve) serve(&pg, argv + optind, argc - optind);
 
+  render(&pg, NULL);
   return 0;
 }
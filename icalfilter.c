@@ -22,11 +22,12 @@
 #include <icaltimezone.h>
 */
 #include <libical/ical.h>
-#include <libical/icalss.h>
-/*
-#include <icalset.h>
-#include <icalfileset.h>
-*/
+#include "calstream.h"
+#include "evfilter.h"
+#include "outbuf.h"
+#include "calwriter.h"
+#include "stats.h"
+#include "words.h"
 
 #define PRODID "-//W3C//NONSGML icalfilter 0.1//EN"
 
@@ -37,13 +38,25 @@
 #define ERR_FILEIO 5
 #define ERR_ICAL_ERR 6		/* Other error */
 
-#define USAGE "Usage: ical2html [options] input output\n\
+#define USAGE "Usage: icalfilter [options] input output\n\
+       icalfilter [options] [filter -o output]... [--rules=FILE] input [output]\n\
   -p, --class=CLASS            only (PUBLIC, CONFIDENTIAL, PRIVATE, NONE)\n\
   -P, --not-class=CLASS        exclude (PUBLIC, CONFIDENTIAL, PRIVATE, NONE)\n\
   -c, --category=CATEGORY      only events of this category\n\
   -C, --not-category=CATEGORY  exclude events of this category\n\
+  -A, --after=DATE             only events starting at or after DATE\n\
+                               (recurring events are not filtered)\n\
+  -B, --before=DATE            only events starting before DATE\n\
+  -U, --summary=TEXT           only events with TEXT in their summary\n\
+  (all but dates may be repeated to give several)\n\
       --add-category=CATEGORY  add category to output events\n\
-  input and output are iCalendar files\n"
+  -o, --output=FILE            write events passing the options so far to FILE\n\
+  -R, --rules=FILE             read more filters from FILE, one per line:\n\
+                               filter options followed by the output file\n\
+  -s, --stream                 handle events while reading (saves memory)\n\
+      --stats[=json]           print times and counts to stderr\n\
+  input and output are iCalendar files, every event goes to every output\n\
+  whose filter it passes\n"
 
 /* Long command line options */
 static struct option options[] = {
@@ -51,11 +64,20 @@ static struct option options[] = {
   {"not-class", 1, 0, 'P'},
   {"category", 1, 0, 'c'},
   {"not-category", 1, 0, 'C'},
+  {"after", 1, 0, 'A'},
+  {"before", 1, 0, 'B'},
+  {"summary", 1, 0, 'U'},
   {"add-category", 1, 0, 'a'},
+  {"output", 1, 0, 'o'},
+  {"rules", 1, 0, 'R'},
+  {"stream", 0, 0, 's'},
+  {"stats", 2, 0, 'X'},
   {0, 0, 0, 0}
 };
 
-#define OPTIONS "p:P:c:C:"
+#define OPTIONS "sp:P:c:C:A:B:U:o:R:"
+
+#define MAX_WORDS 100		/* Max. number of words on a line of rules */
 
 /* Structure for storing applicable events */
 typedef struct _event_item {
@@ -64,6 +86,21 @@ typedef struct _event_item {
   icalcomponent *event;
 } event_item;
 
+/* A filter and the output that the events passing it go to */
+typedef struct _route {
+  evfilter match;		/* Which events pass */
+  const char *addcategory;
+  const char *output;		/* Output file */
+  calwriter out;		/* Writes the VCALENDAR for that file */
+} route;
+
+/* All routes, passed to filter_component() */
+typedef struct _filter {
+  route *routes;
+  int nroutes;
+  unsigned long vevents;	/* VEVENTs read */
+  unsigned long written;	/* VEVENTs written, to any output */
+} filter;
 
 
 /* fatal -- print error message and exit with errcode */
@@ -77,11 +114,158 @@ static void fatal(int errcode, const char *message,...)
 }
 
 
-/* read_stream -- read size bytes into s from stream d */
-static char* read_stream(char *s, size_t size, void *d)  
-{  
-  return fgets(s, size, (FILE*)d); 
-} 
+/* new_route -- add an empty route, return a pointer to it */
+static route *new_route(filter *f)
+{
+  route *r;
+
+  if (!(r = realloc(f->routes, (f->nroutes + 1) * sizeof(*r))))
+    fatal(ERR_OUT_OF_MEM, "Out of memory\n");
+  f->routes = r;
+  r = &f->routes[f->nroutes++];
+  evfilter_init(&r->match, "NONE");
+  r->addcategory = NULL;
+  r->output = NULL;
+  return r;
+}
+
+
+/* filter_option -- add an option to a route, return 0 if it isn't one */
+static int filter_option(route *r, int c, const char *arg)
+{
+  int e;
+
+  switch (c) {
+  case 'p': e = evfilter_add(&r->match, EVFILTER_CLASS, arg); break;
+  case 'P': e = evfilter_add(&r->match, EVFILTER_NOT_CLASS, arg); break;
+  case 'c': e = evfilter_add(&r->match, EVFILTER_CATEGORY, arg); break;
+  case 'C': e = evfilter_add(&r->match, EVFILTER_NOT_CATEGORY, arg); break;
+  case 'U': e = evfilter_add(&r->match, EVFILTER_SUMMARY, arg); break;
+  case 'A': case 'B':
+    if (evfilter_add(&r->match, c == 'A' ? EVFILTER_AFTER : EVFILTER_BEFORE,
+		     arg) != 0)
+      fatal(ERR_DATE, "Incorrect date '%s', must be YYYYMMDD.\n", arg);
+    return 1;
+  case 'a': r->addcategory = arg; return 1;
+  default: return 0;
+  }
+  if (e != 0) fatal(ERR_OUT_OF_MEM, "Out of memory\n");
+  return 1;
+}
+
+
+/* has_output -- check if an earlier route already writes to path */
+static int has_output(const filter *f, const char *path)
+{
+  int i;
+
+  for (i = 0; i < f->nroutes; i++)
+    if (f->routes[i].output && strcmp(f->routes[i].output, path) == 0)
+      return 1;
+  return 0;
+}
+
+
+/* read_rules -- add a route for each line of a rules file */
+static void read_rules(filter *f, const char *path)
+{
+  char *line = NULL, *argv[MAX_WORDS + 1];
+  size_t size = 0;
+  int argc, c, lineno = 0;
+  route *r;
+  FILE *rules;
+
+  if (!(rules = fopen(path, "r")))
+    fatal(ERR_FILEIO, "%s: %s\n", path, strerror(errno));
+  while (getline(&line, &size, rules) != -1) {
+    lineno++;
+    if ((argc = split_words(line, argv + 1, MAX_WORDS)) < 0)
+      fatal(ERR_USAGE, "%s:%d: Line too long or unbalanced quotes\n",
+	    path, lineno);
+    if (argc == 0 || argv[1][0] == '#') continue;
+
+    /* Filter options and an output file, the strings stay in use */
+    argv[0] = "icalfilter";
+    r = new_route(f);
+    optind = 0;			/* Start afresh on this argv */
+    while ((c = getopt_long(argc + 1, argv, OPTIONS, options, NULL)) != -1)
+      if (!filter_option(r, c, optarg))
+	fatal(ERR_USAGE, "%s:%d: Only filter options are allowed\n",
+	      path, lineno);
+    if (optind != argc)
+      fatal(ERR_USAGE, "%s:%d: Need exactly one output file\n", path, lineno);
+    if (has_output(f, argv[optind]))
+      fatal(ERR_USAGE, "%s:%d: %s is already an output\n", path, lineno,
+	    argv[optind]);
+    r->output = argv[optind];
+    line = NULL;
+    size = 0;
+  }
+  free(line);
+  fclose(rules);
+}
+
+
+/* write_event -- write an event that passed a route's filter */
+static void write_event(route *r, icalcomponent *h)
+{
+  icalproperty *p;
+
+  if (!r->addcategory) {
+    calwriter_add(&r->out, h);
+  } else {
+    /* Add the category only while writing, other routes see h as is */
+    p = icalproperty_new_categories(r->addcategory);
+    icalcomponent_add_property(h, p);
+    calwriter_add(&r->out, h);
+    icalcomponent_remove_property(h, p);
+    icalproperty_free(p);
+  }
+}
+
+
+/* filter_component -- write VTIMEZONEs and matching VEVENTs to outputs */
+static int filter_component(icalcomponent *h, void *data)
+{
+  filter *f = (filter *)data;
+  int i;
+
+  /* VTIMEZONEs go to all outputs, and stay, the input may need them */
+  if (icalcomponent_isa(h) == ICAL_VTIMEZONE_COMPONENT) {
+    for (i = 0; i < f->nroutes; i++) calwriter_add(&f->routes[i].out, h);
+    return CALSTREAM_KEEP;
+  }
+
+  /* Events are written right away and not needed after that */
+  f->vevents++;
+  for (i = 0; i < f->nroutes; i++)
+    if (evfilter_match(&f->routes[i].match, h)) {
+      write_event(&f->routes[i], h);
+      f->written++;
+    }
+  return CALSTREAM_FREE;
+}
+
+
+/* keep_component -- calstream_handler that keeps everything */
+static int keep_component(icalcomponent *h, void *data)
+{
+  return CALSTREAM_KEEP;
+}
+
+
+/* filter_calendar -- filter a parsed file, as calstream_parse() would */
+static void filter_calendar(icalcomponent *comp, filter *f)
+{
+  icalcomponent *h;
+
+  for (h = icalcomponent_get_first_component(comp, ICAL_VTIMEZONE_COMPONENT);
+       h; h = icalcomponent_get_next_component(comp, ICAL_VTIMEZONE_COMPONENT))
+    (void) filter_component(h, f);
+  for (h = icalcomponent_get_first_component(comp, ICAL_VEVENT_COMPONENT);
+       h; h = icalcomponent_get_next_component(comp, ICAL_VEVENT_COMPONENT))
+    (void) filter_component(h, f);
+}
 
 
 /* main */
@@ -89,29 +273,36 @@ int main(int argc, char *argv[])
 {
   FILE* stream;
   icalcomponent *comp;
-  icalparser *parser;
-  char *classmask = NULL, *categorymask = NULL;
-  char *notclassmask = NULL, *notcategorymask = NULL;
-  char *addcategory = NULL;
-  char c;
-  const char *class;
-  icalset *out;
-  icalcomponent *h, *next, *newset;
-  icalproperty *p;
+  int c;
+  int streaming = 0, fmt, i;
+  stats_format format = STATS_OFF;
+  const char *rules = NULL;
+  filter f = {NULL, 0, 0, 0};
+  unsigned long bytes = 0;
+  route *r;
+  stats st;
 
   /* We handle errors ourselves */
   icalerror_set_errors_are_fatal(0);
   icalerror_clear_errno();
 
-  /* Read commandline */
+  /* Read commandline, each -o ends the filter for that output */
+  r = new_route(&f);
   while ((c = getopt_long(argc, argv, OPTIONS, options, NULL)) != -1) {
     switch (c) {
-    case 'p': classmask = strdup(optarg); break;
-    case 'P': notclassmask = strdup(optarg); break;
-    case 'c': categorymask = strdup(optarg); break;
-    case 'C': notcategorymask = strdup(optarg); break;
-    case 'a': addcategory = strdup(optarg); break;
-    default: fatal(ERR_USAGE, USAGE);
+    case 's': streaming = 1; break;
+    case 'R': rules = optarg; break;
+    case 'o':
+      if (has_output(&f, optarg))
+	fatal(ERR_USAGE, "%s is already an output\n", optarg);
+      r->output = optarg;
+      r = new_route(&f);
+      break;
+    case 'X':
+      if ((fmt = stats_format_from_string(optarg)) < 0) fatal(ERR_USAGE, USAGE);
+      format = fmt;
+      break;
+    default: if (!filter_option(r, c, optarg)) fatal(ERR_USAGE, USAGE);
     }
   }
   /* Get input file name */
@@ -120,84 +311,58 @@ int main(int argc, char *argv[])
   if (!stream) fatal(ERR_FILEIO, "%s: %s\n", argv[optind], strerror(errno));
   optind++;
 
-  /* Get output file name */
-  if (optind == argc) fatal(ERR_USAGE, USAGE);
-  (void) unlink(argv[optind]);	/* Remove output file if it already exists */
-  out = icalfileset_new(argv[optind]);
-  if (!out) fatal(ERR_FILEIO, "%s: %s\n", argv[optind], strerror(errno));
+  /* The last filter is for the output file argument, if there is one */
+  if (optind < argc) {
+    if (has_output(&f, argv[optind]))
+      fatal(ERR_USAGE, "%s is already an output\n", argv[optind]);
+    r->output = argv[optind++];
+  } else if (r->match.active || r->addcategory) fatal(ERR_USAGE, USAGE);
+  else {evfilter_free(&r->match); f.nroutes--;}
 
   /* Should have no more arguments */
-  if (optind + 1 != argc) fatal(ERR_USAGE, USAGE);
-
-  /* Create a new parser object */
-  parser = icalparser_new();
-
-  /* Tell the parser what input stream it should use */
-  icalparser_set_gen_data(parser, stream);
-
-  /* Let the parser read the file and return all components */
-  if (! (comp = icalparser_parse(parser, read_stream)))
-    fatal(ERR_PARSE, "Parse error: %s\n", icalerror_strerror(icalerrno));
-  icalparser_free(parser);
-
-  /* Initialize a new VCALENDAR */
-  newset = icalcomponent_vanew(ICAL_VCALENDAR_COMPONENT,
-			       icalproperty_new_version("2.0"),
-			       icalproperty_new_prodid(PRODID),
-			       0);
-
-  /* Iterate over VTIMEZONEs */
-  for (h = icalcomponent_get_first_component(comp, ICAL_VTIMEZONE_COMPONENT);
-       h; h = next) {
-    next = icalcomponent_get_next_component(comp, ICAL_VTIMEZONE_COMPONENT);
-    icalcomponent_remove_component(comp, h); /* Move from comp... */
-    icalcomponent_add_component(newset, h); /* ... to out */
+  if (optind != argc) fatal(ERR_USAGE, USAGE);
+
+  if (rules) read_rules(&f, rules);
+  if (f.nroutes == 0) fatal(ERR_USAGE, USAGE);
+
+  /* Start a new VCALENDAR for each output */
+  stats_init(&st, "icalfilter", format);
+  for (i = 0; i < f.nroutes; i++)
+    if (calwriter_open(&f.routes[i].out, f.routes[i].output, PRODID) != 0)
+      fatal(ERR_FILEIO, "%s: %s\n", f.routes[i].output, strerror(errno));
+
+  /* Read the input once, writing VEVENTs to the outputs as they pass */
+  if (streaming) {		/* Parsing and filtering can't be told apart */
+    stats_phase(&st, "parse_filter");
+    comp = calstream_parse(stream, 1, filter_component, &f);
+  } else {
+    stats_phase(&st, "parse");
+    comp = calstream_parse(stream, 0, keep_component, NULL);
+    stats_phase(&st, "filter");
+    if (comp) filter_calendar(comp, &f);
   }
+  if (!comp)
+    fatal(ERR_PARSE, "Parse error: %s\n", icalerror_strerror(icalerrno));
 
-  /* Iterate over VEVENTs */
-  for (h = icalcomponent_get_first_component(comp, ICAL_VEVENT_COMPONENT);
-       h; h = next) {
-
-    next = icalcomponent_get_next_component(comp, ICAL_VEVENT_COMPONENT);
-
-    /* Check if the event is of the right class (unless we accept all) */
-    if (classmask || notclassmask) {
-      p = icalcomponent_get_first_property(h, ICAL_CLASS_PROPERTY);
-      class = p ? icalvalue_as_ical_string(icalproperty_get_value(p))
-	: "NONE";
-      if (classmask && strcasecmp(classmask, class) != 0) continue;
-      if (notclassmask && strcasecmp(notclassmask, class) == 0) continue;
-    }
-
-    /* Check if the event is of the right category (unless we accept all) */
-    if (categorymask) {
-      p = icalcomponent_get_first_property(h, ICAL_CATEGORIES_PROPERTY);
-      while (p && strcasecmp(categorymask, icalproperty_get_categories(p)))
-	p = icalcomponent_get_next_property(h, ICAL_CATEGORIES_PROPERTY);
-      if (!p) continue;		/* No category was equal to categorymask */
-    }
-    if (notcategorymask) {
-      p = icalcomponent_get_first_property(h, ICAL_CATEGORIES_PROPERTY);
-      while (p && strcasecmp(notcategorymask, icalproperty_get_categories(p)))
-	p = icalcomponent_get_next_property(h, ICAL_CATEGORIES_PROPERTY);
-      if (p) continue;		/* Some category equal to notcategorymask */
-    }
-
-    if (addcategory) {
-      icalcomponent_add_property(h, icalproperty_new_categories(addcategory));
-    }
-
-    /* The event passed our filters, so add it to the output set */
-    icalcomponent_remove_component(comp, h); /* Move from comp... */
-    icalcomponent_add_component(newset, h); /* ... to out */
+  /* Finish the output files, they replace the old ones only now */
+  stats_phase(&st, "close");
+  for (i = 0; i < f.nroutes; i++) {
+    r = &f.routes[i];
+    bytes += calwriter_tell(&r->out);
+    if (calwriter_close(&r->out) != 0)
+      fatal(ERR_FILEIO, "%s: %s\n", r->output, strerror(errno));
+    evfilter_free(&r->match);
   }
 
-  /* Put new vcalendar in output file, flush to disk and close file */
-  icalfileset_add_component(out, newset);
-  icalfileset_free(out);
+  stats_add(&st, "vevents", f.vevents);
+  stats_add(&st, "outputs", f.nroutes);
+  stats_add(&st, "vevents_written", f.written);
+  stats_add(&st, "output_bytes", bytes);
+  stats_report(&st, stderr);
 
   /* Clean up */
   icalcomponent_free(comp);
+  free(f.routes);
 
   return 0;
 }
@@ -0,0 +1,295 @@
+/*
+ * icalgen -- write a synthetic iCalendar file for benchmarks
+ *
+ * The output only depends on the options: every event gets its own
+ * pseudo-random numbers, seeded from the seed and the event's number,
+ * so two files made with the same seed have the same events, except
+ * for those that --updated changes. That makes pairs of files to
+ * merge.
+ *
+ * Created: 16 Oct 2026
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <getopt.h>
+
+#define ERR_USAGE 2		/* Program exit codes */
+#define ERR_FILEIO 5
+
+#define USAGE "Usage: icalgen [options] [output]\n\
+  -n, --events=N               number of events (default 10000)\n\
+  -r, --recurring=FRACTION     fraction of events with an RRULE (default 0.2)\n\
+  -x, --complexity=LEVEL       0 (COUNT only) to 3 (BYDAY, BYSETPOS, ...)\n\
+  -o, --overrides=FRACTION     fraction of recurring events with an override\n\
+  -c, --categories=N           number of different categories (default 8)\n\
+  -z, --timezones=N            number of time zones, 0 is UTC (default 0)\n\
+  -u, --updated=FRACTION       fraction of events with a newer LAST-MODIFIED\n\
+  -s, --seed=N                 seed of the pseudo-random numbers (default 1)\n\
+  -y, --start=yyyymmdd         first day of the events (default 20260101)\n\
+  -d, --days=N                 days the events are spread over (default 365)\n\
+  output is an iCalendar file, default is standard output\n"
+
+/* Long command line options */
+static struct option options[] = {
+  {"events", 1, 0, 'n'},
+  {"recurring", 1, 0, 'r'},
+  {"complexity", 1, 0, 'x'},
+  {"overrides", 1, 0, 'o'},
+  {"categories", 1, 0, 'c'},
+  {"timezones", 1, 0, 'z'},
+  {"updated", 1, 0, 'u'},
+  {"seed", 1, 0, 's'},
+  {"start", 1, 0, 'y'},
+  {"days", 1, 0, 'd'},
+  {0, 0, 0, 0}
+};
+
+#define OPTIONS "n:r:x:o:c:z:u:s:y:d:"
+
+/* Time zones, with rules that are simple but valid */
+static const struct {
+  const char *tzid, *std, *dst, *dstrule, *stdrule;
+} zones[] = {
+  {"Europe/Paris", "+0100", "+0200", "BYMONTH=3;BYDAY=-1SU",
+   "BYMONTH=10;BYDAY=-1SU"},
+  {"America/New_York", "-0500", "-0400", "BYMONTH=3;BYDAY=2SU",
+   "BYMONTH=11;BYDAY=1SU"},
+  {"Australia/Sydney", "+1000", "+1100", "BYMONTH=10;BYDAY=1SU",
+   "BYMONTH=4;BYDAY=1SU"},
+  {"Asia/Tokyo", "+0900", NULL, NULL, NULL},
+  {"America/Los_Angeles", "-0800", "-0700", "BYMONTH=3;BYDAY=2SU",
+   "BYMONTH=11;BYDAY=1SU"},
+  {"Asia/Kolkata", "+0530", NULL, NULL, NULL},
+};
+
+#define NZONES (int)(sizeof(zones) / sizeof(zones[0]))
+
+/* Recurrence rules, from simple to complex; %d is the count or interval */
+static const struct {
+  int level;			/* Lowest --complexity that uses it */
+  int step;			/* Days between instances, 0 if irregular */
+  const char *rule;
+} rules[] = {
+  {0, 7, "FREQ=WEEKLY;COUNT=%d"},
+  {0, 1, "FREQ=DAILY;COUNT=%d"},
+  {1, 14, "FREQ=WEEKLY;INTERVAL=2;COUNT=%d"},
+  {1, 0, "FREQ=MONTHLY;COUNT=%d"},
+  {1, 7, "FREQ=WEEKLY"},
+  {2, 0, "FREQ=WEEKLY;BYDAY=MO,WE,FR;COUNT=%d"},
+  {2, 0, "FREQ=MONTHLY;BYMONTHDAY=1,15;COUNT=%d"},
+  {2, 0, "FREQ=YEARLY;BYMONTH=1,4,7,10;BYDAY=1MO"},
+  {3, 0, "FREQ=MONTHLY;BYDAY=MO,TU,WE,TH,FR;BYSETPOS=-1;COUNT=%d"},
+  {3, 0, "FREQ=MONTHLY;BYDAY=-1FR"},
+  {3, 0, "FREQ=YEARLY;BYMONTH=3,6,9,12;BYMONTHDAY=-1;COUNT=%d"},
+};
+
+#define NRULES (int)(sizeof(rules) / sizeof(rules[0]))
+
+static const char *classes[] = {"PUBLIC", "PUBLIC", "PUBLIC", "PRIVATE",
+				"CONFIDENTIAL", NULL};
+
+static const char *words[] = {"meeting", "review", "lunch", "call",
+			      "planning", "seminar", "retro", "demo"};
+
+#define NWORDS (int)(sizeof(words) / sizeof(words[0]))
+
+
+/* fatal -- print error message and exit with errcode */
+static void fatal(int errcode, const char *message,...)
+{
+  va_list args;
+  va_start(args, message);
+  vfprintf(stderr, message, args);
+  va_end(args);
+  exit(errcode);
+}
+
+
+/* next -- splitmix64, the same numbers on every platform */
+static unsigned long long next(unsigned long long *state)
+{
+  unsigned long long z = (*state += 0x9E3779B97F4A7C15ULL);
+
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+
+/* chance -- true with probability p */
+static int chance(unsigned long long *state, double p)
+{
+  return (next(state) >> 11) * (1.0 / 9007199254740992.0) < p;
+}
+
+
+/* days_from_civil -- day number of a date, 0 is 1 Jan 1970 */
+static long days_from_civil(int y, int m, int d)
+{
+  long era, yoe, doy;
+
+  y -= m <= 2;
+  era = (y >= 0 ? y : y - 399) / 400;
+  yoe = y - era * 400;
+  doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+  return era * 146097 + yoe * 365 + yoe / 4 - yoe / 100 + doy - 719468;
+}
+
+
+/* civil_from_days -- date of a day number */
+static void civil_from_days(long z, int *y, int *m, int *d)
+{
+  long era, doe, yoe, doy, mp;
+
+  z += 719468;
+  era = (z >= 0 ? z : z - 146096) / 146097;
+  doe = z - era * 146097;
+  yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  mp = (5 * doy + 2) / 153;
+  *d = doy - (153 * mp + 2) / 5 + 1;
+  *m = mp < 10 ? mp + 3 : mp - 9;
+  *y = yoe + era * 400 + (*m <= 2);
+}
+
+
+/* print_time -- print a property with a local or UTC date-time */
+static void print_time(FILE *out, const char *name, int zone, long day,
+		       int minute)
+{
+  int y, m, d;
+
+  civil_from_days(day, &y, &m, &d);
+  if (zone < 0)
+    fprintf(out, "%s:%04d%02d%02dT%02d%02d00Z\r\n", name, y, m, d,
+	    minute / 60, minute % 60);
+  else
+    fprintf(out, "%s;TZID=%s:%04d%02d%02dT%02d%02d00\r\n", name,
+	    zones[zone].tzid, y, m, d, minute / 60, minute % 60);
+}
+
+
+/* print_zone -- print a VTIMEZONE */
+static void print_zone(FILE *out, int i)
+{
+  fprintf(out, "BEGIN:VTIMEZONE\r\nTZID:%s\r\n", zones[i].tzid);
+  fprintf(out, "BEGIN:STANDARD\r\nDTSTART:19701025T030000\r\n"
+	  "TZOFFSETFROM:%s\r\nTZOFFSETTO:%s\r\n",
+	  zones[i].dst ? zones[i].dst : zones[i].std, zones[i].std);
+  if (zones[i].stdrule)
+    fprintf(out, "RRULE:FREQ=YEARLY;%s\r\n", zones[i].stdrule);
+  fprintf(out, "END:STANDARD\r\n");
+  if (zones[i].dst)
+    fprintf(out, "BEGIN:DAYLIGHT\r\nDTSTART:19700329T020000\r\n"
+	    "TZOFFSETFROM:%s\r\nTZOFFSETTO:%s\r\nRRULE:FREQ=YEARLY;%s\r\n"
+	    "END:DAYLIGHT\r\n", zones[i].std, zones[i].dst, zones[i].dstrule);
+  fprintf(out, "END:VTIMEZONE\r\n");
+}
+
+
+/* main */
+int main(int argc, char *argv[])
+{
+  long nevents = 10000, days = 365, start, i, day, rday;
+  double recurring = 0.2, overrides = 0.0, updated = 0.0;
+  int complexity = 1, ncategories = 8, ntimezones = 0;
+  int c, y, m, d, zone, minute, rule, count, nrules, upd, seq;
+  unsigned long long seed = 1, state;
+  const char *class;
+  FILE *out = stdout;
+
+  start = days_from_civil(2026, 1, 1);
+
+  /* Read commandline */
+  while ((c = getopt_long(argc, argv, OPTIONS, options, NULL)) != -1) {
+    switch (c) {
+    case 'n': nevents = atol(optarg); break;
+    case 'r': recurring = atof(optarg); break;
+    case 'x': complexity = atoi(optarg); break;
+    case 'o': overrides = atof(optarg); break;
+    case 'c': ncategories = atoi(optarg); break;
+    case 'z': ntimezones = atoi(optarg); break;
+    case 'u': updated = atof(optarg); break;
+    case 's': seed = strtoull(optarg, NULL, 10); break;
+    case 'y':
+      if (sscanf(optarg, "%4d%2d%2d", &y, &m, &d) != 3)
+	fatal(ERR_USAGE, USAGE);
+      start = days_from_civil(y, m, d);
+      break;
+    case 'd': days = atol(optarg); break;
+    default: fatal(ERR_USAGE, USAGE);
+    }
+  }
+  if (nevents < 0 || days < 1 || ncategories < 0 || complexity < 0)
+    fatal(ERR_USAGE, USAGE);
+  if (ntimezones > NZONES) ntimezones = NZONES;
+  for (nrules = 0; nrules < NRULES && rules[nrules].level <= complexity;
+       nrules++) ;
+
+  if (optind < argc - 1) fatal(ERR_USAGE, USAGE);
+  if (optind == argc - 1 && !(out = fopen(argv[optind], "w")))
+    fatal(ERR_FILEIO, "%s: cannot create\n", argv[optind]);
+
+  fprintf(out, "BEGIN:VCALENDAR\r\nVERSION:2.0\r\n"
+	  "PRODID:-//W3C//NONSGML icalgen " VERSION "//EN\r\n");
+  for (i = 0; i < ntimezones; i++) print_zone(out, i);
+
+  for (i = 0; i < nevents; i++) {
+
+    /* The event's own numbers, which don't depend on the other events */
+    state = seed * 0x2545F4914F6CDD1DULL + (unsigned long long)i;
+    day = start + next(&state) % days;
+    minute = 15 * (next(&state) % (4 * 24 - 8));
+    zone = ntimezones ? (int)(next(&state) % ntimezones) : -1;
+    class = classes[next(&state) % 6];
+    rule = chance(&state, recurring) ? (int)(next(&state) % nrules) : -1;
+    count = 2 + next(&state) % 50;
+    upd = chance(&state, updated);
+    seq = upd ? 1 : 0;
+
+    fprintf(out, "BEGIN:VEVENT\r\nUID:bench-%ld@example.org\r\n"
+	    "DTSTAMP:20260101T000000Z\r\nLAST-MODIFIED:2026010%dT000000Z\r\n"
+	    "SEQUENCE:%d\r\n", i, 1 + upd, seq);
+    print_time(out, "DTSTART", zone, day, minute);
+    print_time(out, "DTEND", zone, day, minute + 60);
+    fprintf(out, "SUMMARY:%s %ld%s\r\n", words[next(&state) % NWORDS], i,
+	    upd ? " (moved)" : "");
+    fprintf(out, "DESCRIPTION:Generated event %ld\\, with a description "
+	    "long enough to be realistic.\r\nLOCATION:Room %d\r\n", i,
+	    (int)(next(&state) % 100));
+    if (ncategories)
+      fprintf(out, "CATEGORIES:cat%d\r\n", (int)(next(&state) % ncategories));
+    if (class) fprintf(out, "CLASS:%s\r\n", class);
+    if (rule >= 0) {
+      fprintf(out, "RRULE:");
+      fprintf(out, rules[rule].rule, count);
+      fprintf(out, "\r\n");
+    }
+    fprintf(out, "END:VEVENT\r\n");
+
+    /* An override of one instance, a regular one if the rule is simple */
+    if (rule >= 0 && chance(&state, overrides)) {
+      rday = day;
+      if (rules[rule].step) rday += rules[rule].step * (next(&state) % count);
+      fprintf(out, "BEGIN:VEVENT\r\nUID:bench-%ld@example.org\r\n"
+	      "DTSTAMP:20260101T000000Z\r\n"
+	      "LAST-MODIFIED:2026010%dT000000Z\r\nSEQUENCE:%d\r\n",
+	      i, 2 + upd, seq + 1);
+      print_time(out, "RECURRENCE-ID", zone, rday, minute);
+      print_time(out, "DTSTART", zone, rday, minute + 30);
+      print_time(out, "DTEND", zone, rday, minute + 90);
+      fprintf(out, "SUMMARY:%s %ld (moved)\r\n", words[i % NWORDS], i);
+      if (class) fprintf(out, "CLASS:%s\r\n", class);
+      fprintf(out, "END:VEVENT\r\n");
+    }
+  }
+
+  fprintf(out, "END:VCALENDAR\r\n");
+  if (fflush(out) != 0 || ferror(out) || (out != stdout && fclose(out) != 0))
+    fatal(ERR_FILEIO, "Error writing output\n");
+  return 0;
+}
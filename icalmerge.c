@@ -6,7 +6,6 @@
  */
 
 #include "config.h"
-#include <assert.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <errno.h>
@@ -16,10 +15,23 @@
 #include <stdarg.h>
 #include <getopt.h>
 #include <ctype.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef HAVE_MMAP
+#  include <sys/mman.h>
+#endif
+#ifdef HAVE_PTHREAD_H
+#  include <pthread.h>
+#endif
 #include <libical/icalcomponent.h>
 #include <libical/icalparser.h>
-#include <libical/icalset.h>
-#include <libical/icalfileset.h>
+#include "calstream.h"
+#include "outbuf.h"
+#include "calwriter.h"
+#include "uidindex.h"
+#include "mergeindex.h"
+#include "stats.h"
 
 
 #define PRODID "-//W3C//NONSGML icalmerge " VERSION "//EN"
@@ -30,18 +42,80 @@
 #define ERR_PARSE 4
 #define ERR_FILEIO 5
 #define ERR_ICAL_ERR 6		/* Other error */
-#define ERR_HASH 7		/* Hash failure */
-
-#define USAGE "Usage: ical2html input [input...] output\n\
+#define ERR_HASH 7		/* No memory for the UID index */
+
+#define USAGE "Usage: icalmerge [options] input [input...] output\n\
+  -s, --stream                 handle events while reading (saves memory)\n\
+  -v, --verbose                print statistics to stderr\n\
+  -j, --jobs=N                 parse N inputs at once (not with -s)\n\
+  -i, --incremental            only merge what changed since the last run\n\
+      --stats[=json]           print times and counts to stderr\n\
   inputs and output are iCalendar files\n"
 
 /* Long command line options */
 static struct option options[] = {
+  {"stream", 0, 0, 's'},
+  {"verbose", 0, 0, 'v'},
+  {"jobs", 1, 0, 'j'},
+  {"incremental", 0, 0, 'i'},
+  {"stats", 2, 0, 'X'},
   {0, 0, 0, 0}
 };
 
-#define OPTIONS ""
-
+#define OPTIONS "svj:i"
+
+/* A growing list of components */
+typedef struct _complist {
+  icalcomponent **items;
+  long n, size;
+} complist;
+
+/* What merge() has found so far, the VTIMEZONEs belong to the inputs,
+ * the events have been taken out of them (see calstream_release()) */
+typedef struct _merger {
+  uidindex zoneindex;		/* TZID -> index in zones */
+  complist zones;		/* VTIMEZONEs, the first of each TZID */
+  uidindex index;		/* UID, RECURRENCE-ID -> index in events */
+  complist events;		/* The newest version of every event */
+  complist inputs;		/* The parsed input files, freed at the end */
+  long dropped;			/* Number of older overrides left out */
+  unsigned long vevents;	/* VEVENTs seen */
+  unsigned long replaced;	/* Times a newer version replaced a winner */
+  stats *st;
+} merger;
+
+/* What merge_incremental() needs to find the inputs to merge again */
+typedef struct _closure {
+  const mergeindex *old;	/* The index of the previous run */
+  uidindex keys;		/* Key -> last entry in old->keys with it */
+  long *next;			/* Previous entry in old->keys with that key */
+  long *first;			/* Where each input's keys start in old->keys */
+  const mergelist *cur;		/* The keys of the inputs now, by input */
+  uidindex rank;		/* Key -> first entry in cur with it */
+  const char *changed;		/* Inputs that changed */
+  uidindex touched;		/* Key -> 1 if merged again, 0 if copied */
+  char *affected;		/* Inputs that are parsed and merged */
+} closure;
+
+/* A component of the incremental output, copied or merged */
+typedef struct _piece {
+  long rank;			/* See closure.rank */
+  const mergeentry *record;	/* Copy from the old output, or NULL */
+  icalcomponent *comp;		/* Else this merged component */
+} piece;
+
+#ifdef HAVE_PTHREAD_H
+/* Input files to be parsed by several threads */
+typedef struct _parse_pool {
+  char **paths;			/* The input files */
+  int n;
+  icalcomponent **parsed;	/* Their VCALENDARs, or NULL */
+  int *errors;			/* errno if a file failed, or 0 */
+  icalerrorenum *parse_errors;	/* icalerrno if a file didn't parse */
+  int next;			/* Next file for a thread */
+  pthread_mutex_t lock;
+} parse_pool;
+#endif
 
 
 /* fatal -- print error message and exit with errcode */
@@ -67,219 +141,764 @@ static void debug(const char *message,...)
 }
 
 
-#ifdef HAVE_SEARCH_H
-#  include <search.h>
-#else
-/*
- * hsearch() on Mac OS X 10.1.2 appears to be broken: there is no
- * search.h, there is a search() in the C library, but it doesn't work
- * properly. We include some hash functions here, protected by
- * HAVE_SEARCH_H. Hopefully when search.h appears in Mac OS X,
- * hsearch() will be fixed at the same time...
- */
+/* append -- add a component to a list, return its index */
+static long append(complist *l, icalcomponent *h)
+{
+  icalcomponent **items;
 
-typedef struct entry {char *key; void *data;} ENTRY;
-typedef enum {FIND, ENTER} ACTION;
+  if (l->n == l->size) {
+    l->size = 2 * l->size + 1024;
+    if (!(items = realloc(l->items, l->size * sizeof(*items))))
+      fatal(ERR_OUT_OF_MEM, "Out of memory\n");
+    l->items = items;
+  }
+  l->items[l->n] = h;
+  return l->n++;
+}
 
-static ENTRY *htab;
-static int *htab_index1, *htab_index2;
-static unsigned int htab_size = 0;
-static unsigned int htab_inited;
+
+/* override_is_newer -- check if override b replaces a, same UID and RID
+ *
+ * The newest LAST-MODIFIED wins, then the highest SEQUENCE. If neither
+ * tells them apart, the first one stays. */
+static int override_is_newer(icalcomponent *a, icalcomponent *b)
+{
+  icalproperty *mod_a, *mod_b;
+  int cmp = 0;
+
+  mod_a = icalcomponent_get_first_property(a, ICAL_LASTMODIFIED_PROPERTY);
+  mod_b = icalcomponent_get_first_property(b, ICAL_LASTMODIFIED_PROPERTY);
+  if (mod_a && mod_b)
+    cmp = icaltime_compare(icalproperty_get_lastmodified(mod_a),
+			   icalproperty_get_lastmodified(mod_b));
+  if (cmp == 0)
+    cmp = icalcomponent_get_sequence(a) < icalcomponent_get_sequence(b)
+      ? -1 : 0;
+  return cmp < 0;
+}
 
 
-/* isprime -- test if n is a prime number */
-static int isprime(unsigned int n)
+/* recurrence_key -- the RECURRENCE-ID of override h as a key string
+ *
+ * A time with a TZID is converted to UTC, so "20261016T070000Z" and
+ * "TZID=Europe/Paris:20261016T090000" are the same instance. The zone
+ * is looked for in h's calendar, then in libical's built-in zones. If
+ * it can't be found, the TZID is part of the key, "Europe/Paris:..." */
+static char *recurrence_key(icalcomponent *h, icalproperty *rid, char *buf,
+			    size_t size)
 {
-  /* Simplistic algorithm, probably good enough for now */
-  unsigned int i;
-  assert(n % 2);				/* n not even */
-  for (i = 3; i * i < n; i += 2) if (n % i == 0) return 0;
-  return 1;
+  icalparameter *param;
+  icalcomponent *cal;
+  icaltimezone *zone = NULL;
+  struct icaltimetype t;
+  const char *tzid = NULL;
+
+  t = icalproperty_get_recurrenceid(rid);
+  if ((param = icalproperty_get_first_parameter(rid, ICAL_TZID_PARAMETER)))
+    tzid = icalparameter_get_tzid(param);
+  if (tzid && !t.is_utc && !t.is_date && !icaltime_is_null_time(t)) {
+    if ((cal = icalcomponent_get_parent(h)))
+      zone = icalcomponent_get_timezone(cal, tzid);
+    if (!zone) zone = icaltimezone_get_builtin_timezone(tzid);
+  }
+  if (zone) {
+    icaltime_set_timezone(&t, zone);
+    t = icaltime_convert_to_zone(t, icaltimezone_get_utc_timezone());
+    snprintf(buf, size, ":%s", icaltime_as_ical_string(t));
+  } else {
+    snprintf(buf, size, "%s:%s", tzid && !t.is_utc ? tzid : "",
+	     icalproperty_get_value_as_string(rid));
+  }
+  return buf;
 }
 
 
-/* hcreate -- create a hash table for at least nel entries */
-static int hcreate(size_t nel)
+/* merge -- remember h, keeping only newer entries in case of duplicates
+ *
+ * VTIMEZONEs stay in their input calendar, events are taken out of it.
+ * When a newer version of an event is found, it takes the place of the
+ * older one in m->events and the older one is freed right away, without
+ * a search through the calendar it came from. */
+static int merge(icalcomponent *h, void *data)
 {
-  /* Change nel to next higher prime */
-  for (nel |= 1; !isprime(nel); nel += 2) ;
+  merger *m = (merger *)data;
+  icalproperty *mod_a, *mod_b;
+  struct icaltimetype modif_a, modif_b;
+  icalproperty *uid;
+  icalproperty *tzid_prop, *rid;
+  const char *tzid;
+  char ridkey[1024];
+  long *e;
+
+  if (icalcomponent_isa(h) == ICAL_VTIMEZONE_COMPONENT) {
+
+    tzid_prop = icalcomponent_get_first_property(h, ICAL_TZID_PROPERTY);
+    if (!tzid_prop)
+      return CALSTREAM_KEEP;
+
+    tzid = icalproperty_get_tzid(tzid_prop);
+    if (!tzid)
+      return CALSTREAM_KEEP;
+
+    /* Skip existing TZIDs, should use icalcomponent_merge_component() instead. */
+    if (! (e = uidindex_find(&m->zoneindex, tzid, "")))
+      fatal(ERR_HASH, "No room in UID index\n");
+    if (*e < 0) *e = append(&m->zones, h);
+    return CALSTREAM_KEEP;
+  }
+
+  m->vevents++;
+  uid = icalcomponent_get_first_property(h, ICAL_UID_PROPERTY);
+  /*debug("%s", uid ? icalproperty_get_uid(uid) : "NO UID!?");*/
+  if (!uid) return CALSTREAM_FREE;		/* Error in iCalendar file */
+
+  /* VEVENTs with RECURRENCE-ID override specific instances of recurring
+   * VEVENTs and have the same UID as the recurring event, so they are
+   * indexed by UID *and* RECURRENCE-ID. */
+  if ((rid = icalcomponent_get_first_property(h, ICAL_RECURRENCEID_PROPERTY))) {
+    if (! (e = uidindex_find(&m->index, icalproperty_get_uid(uid),
+			     recurrence_key(h, rid, ridkey, sizeof(ridkey)))))
+      fatal(ERR_HASH, "No room in UID index\n");
+    if (*e < 0) {
+      *e = append(&m->events, h);
+      return CALSTREAM_TAKE;
+    }
+    m->dropped++;
+    if (override_is_newer(m->events.items[*e], h)) {
+      calstream_release(m->events.items[*e]);
+      m->events.items[*e] = h;
+      m->replaced++;
+      return CALSTREAM_TAKE;
+    }
+    return CALSTREAM_FREE;
+  }
 
-  /* Allocate hash table and array to keep track of initialized entries */
-  if (! (htab = malloc(nel * sizeof(*htab)))) return 0;
-  if (! (htab_index1 = malloc(nel * sizeof(*htab_index1)))) return 0;
-  if (! (htab_index2 = malloc(nel * sizeof(*htab_index2)))) return 0;
-  htab_inited = 0;
-  htab_size = nel;
+  if (! (e = uidindex_find(&m->index, icalproperty_get_uid(uid), "")))
+    fatal(ERR_HASH, "No room in UID index\n");
+  if (*e < 0) {
+
+    /* New UID, add the VEVENT to the index and to the events */
+    *e = append(&m->events, h);
+    /*debug(" (added %lx)\n", h);*/
+    return CALSTREAM_TAKE;
+  }
 
+  /* Already an entry with this UID, compare modified dates */
+  /*debug(" (found %lx", m->events.items[*e]);*/
+  mod_a = icalcomponent_get_first_property(m->events.items[*e],
+					   ICAL_LASTMODIFIED_PROPERTY);
+  if (!mod_a) return CALSTREAM_FREE;	/* Hmmm... */
+  modif_a = icalproperty_get_lastmodified(mod_a);
+
+  mod_b = icalcomponent_get_first_property(h, ICAL_LASTMODIFIED_PROPERTY);
+  if (!mod_b) return CALSTREAM_FREE;	/* Hmmm... */
+  modif_b = icalproperty_get_lastmodified(mod_b);
+
+  if (icaltime_compare(modif_a, modif_b) == -1) {
+    /* a is older than b, so replace it, in the same place */
+    calstream_release(m->events.items[*e]);
+    m->events.items[*e] = h;
+    m->replaced++;
+    /*debug(" replaced)\n");*/
+    return CALSTREAM_TAKE;
+  }
+
+  /*debug(" ignored)\n");*/
+  return CALSTREAM_FREE;
+}
+
+
+/* keep_component -- calstream_handler that keeps everything */
+static int keep_component(icalcomponent *h, void *data)
+{
+  return CALSTREAM_KEEP;
+}
+
+
+/* component_key -- kind, UID (or TZID) and RECURRENCE-ID of a component
+ *
+ * Returns 0 for components that merge() leaves out of the output. */
+static int component_key(icalcomponent *h, char *kind, const char **uid,
+			 char *rid, size_t size)
+{
+  icalproperty *p;
+
+  *rid = '\0';
+  if (icalcomponent_isa(h) == ICAL_VTIMEZONE_COMPONENT) {
+    *kind = 'Z';
+    p = icalcomponent_get_first_property(h, ICAL_TZID_PROPERTY);
+    return p && (*uid = icalproperty_get_tzid(p));
+  }
+  *kind = 'E';
+  p = icalcomponent_get_first_property(h, ICAL_UID_PROPERTY);
+  if (!p || !(*uid = icalproperty_get_uid(p))) return 0;
+  if ((p = icalcomponent_get_first_property(h, ICAL_RECURRENCEID_PROPERTY)))
+    (void) recurrence_key(h, p, rid, size);
   return 1;
 }
 
 
-#if 0
-/* hdestroy -- deallocate hash table */
-static void hdestroy(void)
+/* find_key -- look up a key of the index in a uidindex, add it if needed */
+static long *find_key(uidindex *ix, char kind, const char *uid,
+		      const char *rid)
 {
-  assert(htab_size);
-  free(htab_index1);
-  free(htab_index2);
-  free(htab);
-  htab_size = 0;
+  char krid[1026];
+  long *v;
+
+  /* The kind goes with the RECURRENCE-ID, as a TZID may look like a UID */
+  snprintf(krid, sizeof(krid), "%c%s", kind, rid);
+  if (!(v = uidindex_find(ix, uid, krid)))
+    fatal(ERR_HASH, "No room in UID index\n");
+  return v;
 }
-#endif
 
 
-/* hsearch -- search for and/or insert an entry in the hash table */
-static ENTRY *hsearch(ENTRY item, ACTION action)
+/* get_key -- the value of a key in a uidindex, or -1 if it isn't there */
+static long get_key(const uidindex *ix, char kind, const char *uid,
+		    const char *rid)
 {
-  unsigned int hval, i;
-  char *p;
+  char krid[1026];
+  const long *v;
+
+  snprintf(krid, sizeof(krid), "%c%s", kind, rid);
+  return (v = uidindex_get(ix, uid, krid)) ? *v : -1;
+}
 
-  assert(htab_size);				/* There must be a hash table */
 
-  /* Compute a hash value */
-#if 1
-  /* This function suggested by Dan Bernstein */
-  for (hval = 5381, p = item.key; *p; p++) hval = (hval * 33) ^ *p;
-#else
-  i = hval = strlen(item.key);
-  do {i--; hval = (hval << 1) + item.key[i];} while (i > 0);
-#endif
-  hval %= htab_size;
-  /* if (action == ENTER) debug("%d\n", hval); */
-
-  /* Look for either an empty slot or an entry with the wanted key */
-  i = hval;
-  while (htab_index1[i] < htab_inited
-	 && htab_index2[htab_index1[i]] == i
-	 && strcmp(htab[i].key, item.key) != 0) {
-    i = (i + 1) % htab_size;			/* "Open" hash method */
-    if (i == hval) return NULL;			/* Made full round */
-  }
-  /* Now we either have an empty slot or an entry with the same key */
-  if (action == ENTER) {
-    htab[i].key = item.key;			/* Put the item in this slot */
-    htab[i].data = item.data;
-    if (htab_index1[i] >= htab_inited || htab_index2[htab_index1[i]] != i) {
-      /* Item was not yet used, mark it as used */
-      htab_index1[i] = htab_inited;
-      htab_index2[htab_inited] = i;
-      htab_inited++;
+/* take_events -- take the VEVENTs out of a parsed file, in one pass
+ *
+ * Components are removed from the front of comp's list, where
+ * icalcomponent_remove_component() finds them at once. The VTIMEZONEs
+ * go back in, the events keep comp as their parent, as if merge() had
+ * taken them while streaming, and the rest is freed. */
+static void take_events(icalcomponent *comp, complist *events)
+{
+  complist zones = {NULL, 0, 0};
+  icalcomponent *h;
+  long i;
+
+  while ((h = icalcomponent_get_first_component(comp, ICAL_ANY_COMPONENT))) {
+    icalcomponent_remove_component(comp, h);
+    switch (icalcomponent_isa(h)) {
+    case ICAL_VTIMEZONE_COMPONENT: (void) append(&zones, h); break;
+    case ICAL_VEVENT_COMPONENT:
+      icalcomponent_set_parent(h, comp);
+      (void) append(events, h);
+      break;
+    default: icalcomponent_free(h);
     }
-    return &htab[i];
-  } else if (htab_index1[i] < htab_inited && htab_index2[htab_index1[i]] == i)
-    return &htab[i];				/* action == FIND, found key */
+  }
+  for (i = 0; i < zones.n; i++)
+    icalcomponent_add_component(comp, zones.items[i]);
+  free(zones.items);
+}
+
+
+/* selected -- check if the key of h has a positive value in only */
+static int selected(icalcomponent *h, const uidindex *only)
+{
+  char kind, rid[1024];
+  const char *uid;
+
+  return component_key(h, &kind, &uid, rid, sizeof(rid))
+    && get_key(only, kind, uid, rid) > 0;
+}
 
-  return NULL;					/* Found empty slot */
+
+/* merge_parsed -- merge a parsed file, in the order calstream_parse() would
+ *
+ * If only is not NULL, only components whose key has a positive value
+ * in it are merged, the others are left out. */
+static void merge_parsed(icalcomponent *comp, merger *m, const uidindex *only)
+{
+  complist events = {NULL, 0, 0};
+  icalcomponent *h;
+  long i;
+
+  take_events(comp, &events);
+  for (h = icalcomponent_get_first_component(comp, ICAL_VTIMEZONE_COMPONENT);
+       h; h = icalcomponent_get_next_component(comp, ICAL_VTIMEZONE_COMPONENT))
+    if (!only || selected(h, only)) (void) merge(h, m);
+  for (i = 0; i < events.n; i++) {
+    h = events.items[i];
+    if ((only && !selected(h, only)) || merge(h, m) == CALSTREAM_FREE)
+      calstream_release(h);
+  }
+  free(events.items);
+  (void) append(&m->inputs, comp);
 }
 
-#endif /* HAVE_SEARCH_H */
+
+/* add_keys -- add the keys of a parsed file, in merge_parsed() order */
+static void add_keys(icalcomponent *comp, mergelist *keys, int input)
+{
+  icalcomponent_kind kinds[] = {ICAL_VTIMEZONE_COMPONENT, ICAL_VEVENT_COMPONENT};
+  icalcomponent *h;
+  char kind, rid[1024];
+  const char *uid;
+  int i;
+
+  for (i = 0; i < 2; i++)
+    for (h = icalcomponent_get_first_component(comp, kinds[i]); h;
+	 h = icalcomponent_get_next_component(comp, kinds[i]))
+      if (component_key(h, &kind, &uid, rid, sizeof(rid))
+	  && mergeindex_add(keys, input, kind, 0, 0, uid, rid) != 0)
+	fatal(ERR_OUT_OF_MEM, "Out of memory\n");
+}
 
 
-/* merge -- add b to a, keeping only newer entries in case of duplicates */
-static void merge(icalcomponent **a, icalcomponent *b)
+/* parse_file -- parse a whole file, return 0 or an errno
+ *
+ * If the file doesn't parse, *comp is NULL and *err says why. icalerrno
+ * is per thread, so it is saved here, in the thread that parsed. */
+static int parse_file(const char *path, icalcomponent **comp,
+		      icalerrorenum *err)
 {
-  static int first_time = 1;
-  icalcomponent *h, *next;
-  icalproperty *mod_a, *mod_b;
-  struct icaltimetype modif_a, modif_b;
-  icalproperty *uid;
-  icalproperty *tzid_prop;
-  const char *tzid;
-  ENTRY *e, e1;
+  FILE *stream;
 
-  /* Create the hash table */
-  if (first_time) {
-    if (! hcreate(10000)) fatal(ERR_HASH, "%s\n", strerror(errno));
-    first_time = 0;
+  if (!(stream = fopen(path, "r"))) return errno;
+  *comp = calstream_parse(stream, 0, keep_component, NULL);
+  if (!*comp) *err = icalerrno;
+  if (fclose(stream) != 0) return errno;
+  return 0;
+}
+
+
+#ifdef HAVE_PTHREAD_H
+/* parse_worker -- parse input files until none are left */
+static void *parse_worker(void *arg)
+{
+  parse_pool *pool = (parse_pool *)arg;
+  int i;
+
+  for (;;) {
+    pthread_mutex_lock(&pool->lock);
+    i = pool->next++;
+    pthread_mutex_unlock(&pool->lock);
+    if (i >= pool->n) break;
+    pool->errors[i] = parse_file(pool->paths[i], &pool->parsed[i],
+				 &pool->parse_errors[i]);
   }
+  return NULL;
+}
+#endif
 
-  /* Iterate over VTIMEZONEs */
-  for (h = icalcomponent_get_first_component(b, ICAL_VTIMEZONE_COMPONENT);
-       h; h = next) {
 
-    next = icalcomponent_get_next_component(b, ICAL_VTIMEZONE_COMPONENT);
+/* parse_files -- parse n files into parsed[], with nthreads threads
+ *
+ * Errors are reported for the first file that has one, as parsing
+ * them in order would have. */
+static void parse_files(char *paths[], int n, int nthreads,
+			icalcomponent *parsed[])
+{
+  icalerrorenum *parse_errors;
+  int *errors, i;
+#ifdef HAVE_PTHREAD_H
+  pthread_t *threads;
+  parse_pool pool;
+  int started;
+#endif
 
-    tzid_prop = icalcomponent_get_first_property(h, ICAL_TZID_PROPERTY);
-    if (!tzid_prop)
-      continue;
+  if (!(errors = calloc(n, sizeof(*errors)))
+      || !(parse_errors = calloc(n, sizeof(*parse_errors))))
+    fatal(ERR_OUT_OF_MEM, "Out of memory\n");
+
+#ifdef HAVE_PTHREAD_H
+  if (nthreads > n) nthreads = n;
+  if (nthreads > 1) {
+    pool.paths = paths;
+    pool.n = n;
+    pool.next = 0;
+    pool.parsed = parsed;
+    pool.errors = errors;
+    pool.parse_errors = parse_errors;
+    pthread_mutex_init(&pool.lock, NULL);
+    if (!(threads = calloc(nthreads, sizeof(*threads))))
+      fatal(ERR_OUT_OF_MEM, "Out of memory\n");
+
+    /* This thread is one of the workers */
+    for (started = 1; started < nthreads; started++)
+      if (pthread_create(&threads[started], NULL, parse_worker, &pool) != 0)
+	break;
+    parse_worker(&pool);
+    for (i = 1; i < started; i++) pthread_join(threads[i], NULL);
+    pthread_mutex_destroy(&pool.lock);
+    free(threads);
+  } else
+#endif
+    for (i = 0; i < n; i++)
+      errors[i] = parse_file(paths[i], &parsed[i], &parse_errors[i]);
+
+  for (i = 0; i < n; i++) {
+    if (errors[i]) fatal(ERR_FILEIO, "%s: %s\n", paths[i], strerror(errors[i]));
+    if (!parsed[i])
+      fatal(ERR_PARSE, "Parse error: %s\n",
+	    icalerror_strerror(parse_errors[i]));
+  }
+  free(errors);
+  free(parse_errors);
+}
 
-    tzid = icalproperty_get_tzid(tzid_prop);
-    if (!tzid)
-      continue;
 
-    /* Skip existing TZIDs, should use icalcomponent_merge_component() instead. */
-    if (icalcomponent_get_timezone(*a, tzid))
-      continue;
+/* merge_parallel -- parse the inputs with nthreads threads, then merge
+ *
+ * The files are merged in the order they were given, after they have
+ * all been parsed, so the result is the same as without threads. */
+static void merge_parallel(char *paths[], int n, int nthreads, merger *m)
+{
+  icalcomponent **parsed;
+  int i;
+
+  if (!(parsed = calloc(n, sizeof(*parsed))))
+    fatal(ERR_OUT_OF_MEM, "Out of memory\n");
+  stats_phase(m->st, "parse");
+  parse_files(paths, n, nthreads, parsed);
+  stats_phase(m->st, "merge");
+  for (i = 0; i < n; i++) merge_parsed(parsed[i], m, NULL);
+  free(parsed);
+}
+
 
-    icalcomponent_remove_component(b, h); /* Move from b... */
-    icalcomponent_add_component(*a, h); /* ... to a */
+/* touch -- mark a key of a changed input as merged again
+ *
+ * An event is merged again from all inputs that have its key. A time
+ * zone comes from the first input with its TZID, so only that input is
+ * needed, and not even that if the old output has the zone from it and
+ * it didn't change. Only the keys of changed inputs are touched: the
+ * other keys of the inputs this pulls in keep their old winners. */
+static void touch(closure *c, char kind, const char *uid, const char *rid)
+{
+  long k, w, w0 = -1;
+
+  if (get_key(&c->touched, kind, uid, rid) >= 0) return; /* Already done */
+  if (kind == 'Z') {
+    if ((w = get_key(&c->rank, kind, uid, rid)) >= 0)
+      w = c->cur->items[w].input;
+    for (k = get_key(&c->keys, kind, uid, rid); k >= 0; k = c->next[k])
+      w0 = c->old->keys.items[k].input;	/* The chain ends at the first */
+    if (w >= 0 && w == w0 && !c->changed[w]) {
+      *find_key(&c->touched, kind, uid, rid) = 0;
+      return;
+    }
+    if (w >= 0) c->affected[w] = 1;
+  } else {
+    for (k = get_key(&c->keys, kind, uid, rid); k >= 0; k = c->next[k])
+      c->affected[c->old->keys.items[k].input] = 1;
   }
+  *find_key(&c->touched, kind, uid, rid) = 1;
+}
+
 
-  /* Iterate over VEVENTs */
-  for (h = icalcomponent_get_first_component(b, ICAL_VEVENT_COMPONENT);
-       h; h = next) {
+/* compare_pieces -- compare the ranks of two pieces of the output */
+static int compare_pieces(const void *a, const void *b)
+{
+  long r = ((const piece *)a)->rank, s = ((const piece *)b)->rank;
 
-    next = icalcomponent_get_next_component(b, ICAL_VEVENT_COMPONENT);
+  return r < s ? -1 : r > s ? 1 : 0;
+}
 
-    uid = icalcomponent_get_first_property(h, ICAL_UID_PROPERTY);
-    /*debug("%s", uid ? icalproperty_get_uid(uid) : "NO UID!?");*/
-    if (!uid) continue;				/* Error in iCalendar file */
 
-    /* Always add VEVENTs with RECURRENCE-ID, as these are events overriding
-     * specific instances of recurring VEVENTs and have the same UID as the
-     * recurring event. We could try to filter VEVENTs with same UID *and*
-     * RECURRENCE-ID. */
-    if (icalcomponent_get_first_property(h, ICAL_RECURRENCEID_PROPERTY)) {
-      icalcomponent_remove_component(b, h); /* Move from b... */
-      icalcomponent_add_component(*a, h); /* ... to a */
-      continue;
+/* map_file -- get the contents of a file, NULL if it can't be read */
+static char *map_file(const char *path, size_t *len)
+{
+  struct stat st;
+  char *map = NULL;
+#ifndef HAVE_MMAP
+  ssize_t k;
+  size_t n;
+#endif
+  int fd;
+
+  if ((fd = open(path, O_RDONLY)) < 0) return NULL;
+  if (fstat(fd, &st) == 0 && st.st_size > 0) {
+    *len = st.st_size;
+#ifdef HAVE_MMAP
+    map = mmap(NULL, *len, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) map = NULL;
+#else
+    if ((map = malloc(*len))) {
+      for (n = 0; n < *len; n += k)
+	if ((k = read(fd, map + n, *len - n)) <= 0) {
+	  if (k < 0 && errno == EINTR) k = 0;
+	  else break;
+	}
+      if (n < *len) {free(map); map = NULL;}
     }
+#endif
+  }
+  close(fd);
+  return map;
+}
+
 
-    e1.key = strdup(icalproperty_get_uid(uid));
-    if (! (e = hsearch(e1, FIND))) {
+/* unmap_file -- release what map_file() returned */
+static void unmap_file(char *map, size_t len)
+{
+#ifdef HAVE_MMAP
+  if (map) munmap(map, len);
+#else
+  free(map);
+#endif
+}
 
-      /* New UID, add the VEVENT to the hash and to the set a */
-      icalcomponent_remove_component(b, h); /* Move from b... */
-      icalcomponent_add_component(*a, h); /* ... to a */
-      e1.data = h;
-      if (! (e = hsearch(e1, ENTER)))
-	fatal(ERR_OUT_OF_MEM, "No room in hash table\n");
-      /*debug(" (added %lx)\n", h);*/
 
-    } else {
+/* write_kind -- write old and new components of one kind, index them
+ *
+ * The components are written in the order of the first input key they
+ * have, which is the order a full merge would write them in. */
+static unsigned long write_kind(calwriter *out, mergeindex *cur,
+				const closure *c, const char *map,
+				size_t maplen, char kind,
+				const complist *merged)
+{
+  const mergelist *records = &c->old->records;
+  unsigned long offset, copied = 0;
+  const mergeentry *e;
+  char k, rid[1024];
+  const char *uid;
+  piece *v;
+  long i, n = 0;
+
+  if (!(v = malloc((records->n + merged->n + 1) * sizeof(*v))))
+    fatal(ERR_OUT_OF_MEM, "Out of memory\n");
+
+  /* The components of the old output that nothing could change */
+  for (i = 0; i < records->n; i++) {
+    e = &records->items[i];
+    if (e->kind != kind || get_key(&c->touched, kind, e->uid, e->rid) > 0)
+      continue;
+    if (e->offset + e->length > maplen)
+      fatal(ERR_FILEIO, "Old output doesn't match its index\n");
+    v[n].rank = get_key(&c->rank, kind, e->uid, e->rid);
+    v[n].record = e;
+    v[n++].comp = NULL;
+  }
+
+  /* The winners of the keys that were merged again */
+  for (i = 0; i < merged->n; i++) {
+    if (!component_key(merged->items[i], &k, &uid, rid, sizeof(rid)))
+      continue;
+    v[n].rank = get_key(&c->rank, k, uid, rid);
+    v[n].record = NULL;
+    v[n++].comp = merged->items[i];
+  }
 
-      /* Already an entry with this UID, compare modified dates */
-      /*debug(" (found %lx", e->data);*/
-      mod_a = icalcomponent_get_first_property((icalcomponent*)e->data,
-					       ICAL_LASTMODIFIED_PROPERTY);
-      if (!mod_a) continue;	/* Hmmm... */
-      modif_a = icalproperty_get_lastmodified(mod_a);
-
-      mod_b = icalcomponent_get_first_property(h, ICAL_LASTMODIFIED_PROPERTY);
-      if (!mod_b) continue;	/* Hmmm... */
-      modif_b = icalproperty_get_lastmodified(mod_b);
-
-      if (icaltime_compare(modif_a, modif_b) == -1) {
-	/* a is older than b, so replace it */
-	icalcomponent_remove_component(*a, (icalcomponent*)e->data);
-	icalcomponent_remove_component(b, h); /* Move from b... */
-	icalcomponent_add_component(*a, h); /* ... to a */
-	e->data = h;
-	/*debug(" replaced)\n");*/
-      } else {
-	/*debug(" ignored)\n");*/
-      }      
-      free(e1.key);
+  qsort(v, n, sizeof(*v), compare_pieces);
+  for (i = 0; i < n; i++) {
+    offset = calwriter_tell(out);
+    if ((e = v[i].record)) {
+      calwriter_copy(out, map + e->offset, e->length);
+      copied++;
+    } else {
+      calwriter_add(out, v[i].comp);
+      (void) component_key(v[i].comp, &k, &uid, rid, sizeof(rid));
     }
+    if (mergeindex_add(&cur->records, -1, kind, offset,
+		       calwriter_tell(out) - offset, e ? e->uid : uid,
+		       e ? e->rid : rid) != 0)
+      fatal(ERR_OUT_OF_MEM, "Out of memory\n");
   }
+  free(v);
+  return copied;
 }
 
 
-/* read_stream -- read size bytes into s from stream d */
-static char* read_stream(char *s, size_t size, void *d)  
-{  
-  return fgets(s, size, (FILE*)d); 
-} 
+/* merge_incremental -- merge only what changed since the last run
+ *
+ * Only the keys that changed inputs have, or had, may get another
+ * winner. Inputs that haven't changed since the index was written are
+ * parsed only if they have one of those keys, and only components with
+ * those keys are merged, from all inputs that have them, in the order
+ * of the inputs. The other components are copied from the old output.
+ * Without a valid index, all inputs count as changed. */
+static void merge_incremental(char *paths[], int n, const char *output,
+			      int nthreads, int verbose, merger *m)
+{
+  mergeindex old, cur;
+  icalcomponent **parsed, **batch;
+  unsigned long long hash;
+  unsigned long copied;
+  char *idxpath, *map, *changed;
+  char **todo;
+  int valid, nchanged, ntodo, i, j;
+  size_t maplen = 0;
+  struct stat st;
+  calwriter out;
+  closure c;
+  const mergeentry *e;
+  long k, *v;
+
+  /* The index of the last run is only useful for the same inputs and
+   * if the output hasn't been changed since */
+  stats_phase(m->st, "check");
+  if (!(idxpath = malloc(strlen(output) + 5)))
+    fatal(ERR_OUT_OF_MEM, "Out of memory\n");
+  sprintf(idxpath, "%s.idx", output);
+  valid = mergeindex_load(&old, idxpath) == 0 && old.ninputs == n
+    && stat(output, &st) == 0 && (unsigned long)st.st_size == old.outsize
+    && st.st_mtime == old.outmtime && st.st_ino == old.outino;
+  for (i = 0; valid && i < n; i++)
+    valid = strcmp(old.inputs[i].path, paths[i]) == 0;
+  if (!valid) mergeindex_free(&old);
+
+  /* Find the inputs that changed, by their contents if they were touched */
+  mergeindex_init(&cur);
+  if (!(changed = calloc(n, 1))) fatal(ERR_OUT_OF_MEM, "Out of memory\n");
+  for (nchanged = 0, i = 0; i < n; i++) {
+    if (stat(paths[i], &st) != 0)
+      fatal(ERR_FILEIO, "%s: %s\n", paths[i], strerror(errno));
+    if (valid && st.st_mtime == old.inputs[i].mtime
+	&& (unsigned long)st.st_size == old.inputs[i].size) {
+      hash = old.inputs[i].hash;
+    } else {
+      if (mergeindex_hash_file(paths[i], &hash) != 0)
+	fatal(ERR_FILEIO, "%s: %s\n", paths[i], strerror(errno));
+      if (!valid || hash != old.inputs[i].hash) {changed[i] = 1; nchanged++;}
+    }
+    if (mergeindex_add_input(&cur, paths[i], st.st_mtime, st.st_size,
+			     hash) != 0)
+      fatal(ERR_OUT_OF_MEM, "Out of memory\n");
+  }
+
+  /* Nothing to merge, but remember new modification times */
+  if (nchanged == 0) {
+    cur.outsize = old.outsize;
+    cur.outmtime = old.outmtime;
+    cur.outino = old.outino;
+    cur.records = old.records;
+    cur.keys = old.keys;
+    memset(&old.records, 0, sizeof(old.records));
+    memset(&old.keys, 0, sizeof(old.keys));
+    if (mergeindex_save(&cur, idxpath) != 0)
+      fatal(ERR_FILEIO, "%s: %s\n", idxpath, strerror(errno));
+    if (verbose) fprintf(stderr, "Incremental: no inputs changed\n");
+    stats_add(m->st, "inputs_changed", 0);
+    mergeindex_free(&old);
+    mergeindex_free(&cur);
+    free(changed);
+    free(idxpath);
+    return;
+  }
+
+  /* Index the keys of the old inputs, chained by key and grouped by input */
+  memset(&c, 0, sizeof(c));
+  c.old = &old;
+  c.cur = &cur.keys;
+  c.changed = changed;
+  uidindex_init(&c.keys);
+  uidindex_init(&c.rank);
+  uidindex_init(&c.touched);
+  if (!(c.next = malloc((old.keys.n + 1) * sizeof(*c.next)))
+      || !(c.first = calloc(n + 1, sizeof(*c.first)))
+      || !(c.affected = calloc(n, 1))
+      || !(parsed = calloc(n, sizeof(*parsed)))
+      || !(batch = calloc(n, sizeof(*batch)))
+      || !(todo = malloc(n * sizeof(*todo))))
+    fatal(ERR_OUT_OF_MEM, "Out of memory\n");
+  for (k = 0; k < old.keys.n; k++) {
+    e = &old.keys.items[k];
+    v = find_key(&c.keys, e->kind, e->uid, e->rid);
+    c.next[k] = *v;
+    *v = k;
+    c.first[e->input + 1]++;
+  }
+  for (i = 0; i < n; i++) c.first[i + 1] += c.first[i];
+
+  /* Parse the changed inputs */
+  for (ntodo = 0, i = 0; i < n; i++)
+    if (changed[i]) todo[ntodo++] = paths[i];
+  stats_phase(m->st, "parse");
+  parse_files(todo, ntodo, nthreads, batch);
+
+  /* The keys of all inputs now, new ones for the changed inputs */
+  stats_phase(m->st, "closure");
+  for (j = 0, i = 0; i < n; i++) {
+    if (changed[i]) {
+      c.affected[i] = 1;
+      add_keys(parsed[i] = batch[j++], &cur.keys, i);
+    } else {
+      for (k = c.first[i]; k < c.first[i + 1]; k++) {
+	e = &old.keys.items[k];
+	if (mergeindex_add(&cur.keys, i, e->kind, 0, 0, e->uid, e->rid) != 0)
+	  fatal(ERR_OUT_OF_MEM, "Out of memory\n");
+      }
+    }
+  }
+  for (k = 0; k < cur.keys.n; k++) {
+    e = &cur.keys.items[k];
+    v = find_key(&c.rank, e->kind, e->uid, e->rid);
+    if (*v < 0) *v = k;
+  }
+
+  /* Touch the old and the new keys of the changed inputs */
+  for (i = 0; i < n; i++)
+    for (k = c.first[i]; changed[i] && k < c.first[i + 1]; k++)
+      touch(&c, old.keys.items[k].kind, old.keys.items[k].uid,
+	    old.keys.items[k].rid);
+  for (k = 0; k < cur.keys.n; k++) {
+    e = &cur.keys.items[k];
+    if (changed[e->input]) touch(&c, e->kind, e->uid, e->rid);
+  }
+
+  /* Parse the unchanged inputs that were pulled in, then merge in order */
+  for (ntodo = 0, i = 0; i < n; i++)
+    if (c.affected[i] && !changed[i]) todo[ntodo++] = paths[i];
+  stats_phase(m->st, "parse");
+  parse_files(todo, ntodo, nthreads, batch);
+  for (j = 0, i = 0; i < n; i++)
+    if (c.affected[i] && !changed[i]) parsed[i] = batch[j++];
+  stats_phase(m->st, "merge");
+  for (i = 0; i < n; i++)
+    if (c.affected[i]) merge_parsed(parsed[i], m, &c.touched);
+
+  /* Write the copied and the merged components, the time zones first */
+  stats_phase(m->st, "write");
+  map = old.records.n ? map_file(output, &maplen) : NULL;
+  if (old.records.n && !map)
+    fatal(ERR_FILEIO, "%s: %s\n", output, strerror(errno));
+  if (calwriter_open(&out, output, PRODID) != 0)
+    fatal(ERR_FILEIO, "%s: %s\n", output, strerror(errno));
+  copied = write_kind(&out, &cur, &c, map, maplen, 'Z', &m->zones);
+  copied += write_kind(&out, &cur, &c, map, maplen, 'E', &m->events);
+  stats_add(m->st, "output_bytes", calwriter_tell(&out));
+  if (calwriter_close(&out) != 0)
+    fatal(ERR_FILEIO, "%s: %s\n", output, strerror(errno));
+  unmap_file(map, maplen);
+
+  /* Index the new output, the keys of the inputs are there already */
+  stats_phase(m->st, "index");
+  if (stat(output, &st) != 0)
+    fatal(ERR_FILEIO, "%s: %s\n", output, strerror(errno));
+  cur.outsize = st.st_size;
+  cur.outmtime = st.st_mtime;
+  cur.outino = st.st_ino;
+  if (mergeindex_save(&cur, idxpath) != 0)
+    fatal(ERR_FILEIO, "%s: %s\n", idxpath, strerror(errno));
+
+  for (j = 0, i = 0; i < n; i++) j += c.affected[i];
+  stats_add(m->st, "inputs_changed", nchanged);
+  stats_add(m->st, "inputs_parsed", j);
+  stats_add(m->st, "components_copied", copied);
+  if (verbose) {
+    fprintf(stderr, "Incremental: %d of %d inputs changed, %d parsed, "
+	    "%lu components copied\n", nchanged, n, j, copied);
+  }
+
+  /* Clean up, the parsed inputs are in m->inputs */
+  mergeindex_free(&old);
+  mergeindex_free(&cur);
+  uidindex_free(&c.keys);
+  uidindex_free(&c.rank);
+  uidindex_free(&c.touched);
+  free(c.next);
+  free(c.first);
+  free(c.affected);
+  free(parsed);
+  free(batch);
+  free(todo);
+  free(changed);
+  free(idxpath);
+}
 
 
 /* main */
@@ -287,10 +906,14 @@ int main(int argc, char *argv[])
 {
   FILE* stream;
   icalcomponent *comp;
-  icalparser *parser;
   char c;
-  icalset *out;
-  icalcomponent *newset;
+  calwriter out;
+  char *end;
+  int streaming = 0, verbose = 0, nthreads = 1, incremental = 0, fmt;
+  stats_format format = STATS_OFF;
+  long i;
+  merger m;
+  stats st;
 
   /* We handle errors ourselves */
   icalerror_set_errors_are_fatal(0);
@@ -299,52 +922,102 @@ int main(int argc, char *argv[])
   /* Read commandline */
   while ((c = getopt_long(argc, argv, OPTIONS, options, NULL)) != -1) {
     switch (c) {
+    case 's': streaming = 1; break;
+    case 'v': verbose = 1; break;
+    case 'j':
+      nthreads = strtol(optarg, &end, 10);
+      if (end == optarg || *end || nthreads < 1) fatal(ERR_USAGE, USAGE);
+      break;
+    case 'i': incremental = 1; break;
+    case 'X':
+      if ((fmt = stats_format_from_string(optarg)) < 0) fatal(ERR_USAGE, USAGE);
+      format = fmt;
+      break;
     default: fatal(ERR_USAGE, USAGE);
     }
   }
 
-  /* Initialize a new, empty icalendar */
-  newset = icalcomponent_vanew(ICAL_VCALENDAR_COMPONENT,
-			       icalproperty_new_version("2.0"),
-			       icalproperty_new_prodid(PRODID),
-			       0);
+  /* Threads and -i parse whole files, they can't also stream */
+  if (streaming && (nthreads > 1 || incremental))
+    fatal(ERR_USAGE, "-s can't be combined with -j or -i\n");
+
+  /* Start with empty indexes */
+  memset(&m, 0, sizeof(m));
+  uidindex_init(&m.zoneindex);
+  uidindex_init(&m.index);
+  stats_init(&st, "icalmerge", format);
+  m.st = &st;
 
   /* Loop over remaining file arguments, except the last */
   if (optind >= argc - 1) fatal(ERR_USAGE, USAGE);
+  if (incremental) {
+    merge_incremental(argv + optind, argc - 1 - optind, argv[argc - 1],
+		      nthreads, verbose, &m);
+    optind = argc - 1;
+  }
+#ifdef HAVE_PTHREAD_H
+  if (nthreads > 1 && argc - 1 - optind > 1) {
+    merge_parallel(argv + optind, argc - 1 - optind, nthreads, &m);
+    optind = argc - 1;
+  }
+#endif
+  if (optind != argc - 1) stats_phase(&st, "parse_merge");
   while (optind != argc - 1) {
 
     /* Open the file */
     stream = fopen(argv[optind], "r");
     if (!stream) fatal(ERR_FILEIO, "%s: %s\n", argv[optind], strerror(errno));
 
-    /* Create a new parser object */
-    /* Tell the parser what input stream it should use */
-    /* Let the parser read the file and return all components */
-    parser = icalparser_new();
-    icalparser_set_gen_data(parser, stream);
-    if (! (comp = icalparser_parse(parser, read_stream)))
+    /* Parse the file and find the newest version of each event */
+    if (streaming) comp = calstream_parse(stream, 1, merge, &m);
+    else comp = calstream_parse(stream, 0, keep_component, NULL);
+    if (!comp)
       fatal(ERR_PARSE, "Parse error: %s\n", icalerror_strerror(icalerrno));
-    icalparser_free(parser);
     if (fclose(stream) != 0)
       fatal(ERR_FILEIO, "%s: %s\n", argv[optind], strerror(errno));
+    if (streaming) (void) append(&m.inputs, comp);
+    else merge_parsed(comp, &m, NULL);
 
-    /* Add all found components to a hash table, removing duplicates */
-    merge(&newset, comp);
-    
     optind++;
   }
 
-  /* Get output file name */
-  (void) unlink(argv[optind]);	/* Remove output file if it already exists */
-  out = icalfileset_new(argv[optind]);
-  if (!out) fatal(ERR_FILEIO, "%s: %s\n", argv[optind], strerror(errno));
+  if (verbose) {
+    fprintf(stderr, "UID index: %lu keys, %lu slots, %.2f probes per lookup\n",
+	    (unsigned long)m.index.n, (unsigned long)m.index.size,
+	    m.index.lookups ? (double)m.index.probes / m.index.lookups : 0.0);
+    fprintf(stderr, "Overrides: %ld duplicates dropped\n", m.dropped);
+  }
 
-  /* Put new icalendar in output file, flush to disk and close file */
-  icalfileset_add_component(out, newset);
-  icalfileset_free(out);
+  /* Write the output once, the time zones first, then the events */
+  if (!incremental) {
+    stats_phase(&st, "write");
+    if (calwriter_open(&out, argv[optind], PRODID) != 0)
+      fatal(ERR_FILEIO, "%s: %s\n", argv[optind], strerror(errno));
+    for (i = 0; i < m.zones.n; i++) calwriter_add(&out, m.zones.items[i]);
+    for (i = 0; i < m.events.n; i++) calwriter_add(&out, m.events.items[i]);
+    stats_add(&st, "output_bytes", calwriter_tell(&out));
+    if (calwriter_close(&out) != 0)
+      fatal(ERR_FILEIO, "%s: %s\n", argv[optind], strerror(errno));
+  }
 
-  /* Clean up */
-  /* icalcomponent_free(newset); */
+  stats_add(&st, "vevents", m.vevents);
+  stats_add(&st, "replacements", m.replaced);
+  stats_add(&st, "overrides_dropped", m.dropped);
+  stats_add(&st, "index_keys", m.index.n);
+  stats_add(&st, "index_lookups", m.index.lookups);
+  stats_add(&st, "index_probes", m.index.probes);
+  stats_add(&st, "vtimezones_written", m.zones.n);
+  stats_add(&st, "vevents_written", m.events.n);
+  stats_report(&st, stderr);
+
+  /* Clean up, the events first, they still point to their inputs */
+  for (i = 0; i < m.events.n; i++) calstream_release(m.events.items[i]);
+  for (i = 0; i < m.inputs.n; i++) icalcomponent_free(m.inputs.items[i]);
+  free(m.inputs.items);
+  free(m.zones.items);
+  free(m.events.items);
+  uidindex_free(&m.zoneindex);
+  uidindex_free(&m.index);
 
   return 0;
 }
@@ -0,0 +1,287 @@
+/*
+ * mergeindex -- what icalmerge wrote last time, for incremental merges
+ *
+ * An index file looks like this:
+ *
+ *     ICALMERGE-INDEX 2
+ *     O <size> <mtime> <inode>                     the output
+ *     I <mtime> <size> <hash> <path>               each input
+ *     R <kind> <offset> <length> <uid> <rid>       each output component
+ *     K <input> <kind> <uid> <rid>                 each input component
+ *
+ * with the fields separated by tabs. Tabs, newlines and backslashes in
+ * paths, UIDs and RECURRENCE-IDs are written as \t, \n and \\. A
+ * RECURRENCE-ID is in icalmerge's form: ":" and the time in UTC if its
+ * zone is known, else "TZID:" and the value as written. (Version 1
+ * had the value as written; such files are not valid any more and the
+ * next run merges everything again.)
+ *
+ * Created: 16 Oct 2026
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "mergeindex.h"
+
+#define MAGIC "ICALMERGE-INDEX 2"
+#define MAX_FIELDS 6		/* Fields on a line, including the type */
+
+
+/* mergeindex_init -- make an empty index */
+void mergeindex_init(mergeindex *ix)
+{
+  memset(ix, 0, sizeof(*ix));
+}
+
+
+/* mergeindex_add_input -- add an input file, returns 0 or -1 */
+int mergeindex_add_input(mergeindex *ix, const char *path, long mtime,
+			 unsigned long size, unsigned long long hash)
+{
+  mergeinput *h;
+
+  if (!(h = realloc(ix->inputs, (ix->ninputs + 1) * sizeof(*h)))) return -1;
+  ix->inputs = h;
+  if (!(h[ix->ninputs].path = strdup(path))) return -1;
+  h[ix->ninputs].mtime = mtime;
+  h[ix->ninputs].size = size;
+  h[ix->ninputs].hash = hash;
+  ix->ninputs++;
+  return 0;
+}
+
+
+/* mergeindex_add -- add a copy of an entry to a list, returns 0 or -1 */
+int mergeindex_add(mergelist *l, int input, char kind, unsigned long offset,
+		   unsigned long length, const char *uid, const char *rid)
+{
+  mergeentry *h, *e;
+  size_t ulen = strlen(uid) + 1, rlen = strlen(rid) + 1;
+
+  if (l->n == l->size) {
+    l->size = 2 * l->size + 1024;
+    if (!(h = realloc(l->items, l->size * sizeof(*h)))) return -1;
+    l->items = h;
+  }
+
+  /* The UID and the RECURRENCE-ID share one block of memory */
+  e = &l->items[l->n];
+  if (!(e->uid = malloc(ulen + rlen))) return -1;
+  memcpy(e->uid, uid, ulen);
+  e->rid = e->uid + ulen;
+  memcpy(e->rid, rid, rlen);
+  e->input = input;
+  e->kind = kind;
+  e->offset = offset;
+  e->length = length;
+  l->n++;
+  return 0;
+}
+
+
+/* unescape -- undo what put_escaped() did, in place */
+static void unescape(char *s)
+{
+  char *t = s;
+
+  for (; *s; s++) {
+    if (*s != '\\' || !s[1]) {*t++ = *s; continue;}
+    switch (*++s) {
+    case 't': *t++ = '\t'; break;
+    case 'n': *t++ = '\n'; break;
+    case 'r': *t++ = '\r'; break;
+    default: *t++ = *s;
+    }
+  }
+  *t = '\0';
+}
+
+
+/* split -- split a line at tabs, return the number of fields */
+static int split(char *line, char *fields[MAX_FIELDS])
+{
+  int n = 0;
+  char *s;
+
+  if ((s = strchr(line, '\n'))) *s = '\0';
+  for (s = line; n < MAX_FIELDS; n++) {
+    fields[n] = s;
+    if (!(s = strchr(s, '\t'))) return n + 1;
+    *s++ = '\0';
+  }
+  return -1;			/* Too many fields */
+}
+
+
+/* mergeindex_load -- read an index file */
+int mergeindex_load(mergeindex *ix, const char *path)
+{
+  char *line = NULL, *f[MAX_FIELDS], *end;
+  size_t linesize = 0;
+  int n, i, ok = 0;
+  FILE *stream;
+
+  mergeindex_init(ix);
+  if (!(stream = fopen(path, "r"))) return -1;
+
+  if (getline(&line, &linesize, stream) < 0
+      || strcmp(line, MAGIC "\n") != 0)
+    goto done;
+
+  while (getline(&line, &linesize, stream) >= 0) {
+    n = split(line, f);
+    for (i = 1; i < n; i++) unescape(f[i]);
+    if (n == 4 && strcmp(f[0], "O") == 0) {
+      ix->outsize = strtoul(f[1], NULL, 10);
+      ix->outmtime = strtol(f[2], NULL, 10);
+      ix->outino = strtoul(f[3], NULL, 10);
+    } else if (n == 5 && strcmp(f[0], "I") == 0) {
+      if (mergeindex_add_input(ix, f[4], strtol(f[1], NULL, 10),
+			       strtoul(f[2], NULL, 10),
+			       strtoull(f[3], NULL, 16)) != 0)
+	goto done;
+    } else if (n == 6 && strcmp(f[0], "R") == 0 && f[1][0]) {
+      if (mergeindex_add(&ix->records, -1, f[1][0], strtoul(f[2], NULL, 10),
+			 strtoul(f[3], NULL, 10), f[4], f[5]) != 0)
+	goto done;
+    } else if (n == 5 && strcmp(f[0], "K") == 0 && f[2][0]) {
+      i = strtol(f[1], &end, 10);
+      if (*end || i < 0 || i >= ix->ninputs
+	  || (ix->keys.n && ix->keys.items[ix->keys.n - 1].input > i))
+	goto done;		/* Keys must be grouped by input */
+      if (mergeindex_add(&ix->keys, i, f[2][0], 0, 0, f[3], f[4]) != 0)
+	goto done;
+    } else {
+      goto done;
+    }
+  }
+  ok = !ferror(stream);
+
+ done:
+  free(line);
+  fclose(stream);
+  if (ok) return 0;
+  mergeindex_free(ix);
+  return -1;
+}
+
+
+/* put_escaped -- write a tab and then s with tabs and newlines escaped */
+static void put_escaped(FILE *stream, const char *s)
+{
+  putc('\t', stream);
+  for (; *s; s++) {
+    switch (*s) {
+    case '\t': fputs("\\t", stream); break;
+    case '\n': fputs("\\n", stream); break;
+    case '\r': fputs("\\r", stream); break;
+    case '\\': fputs("\\\\", stream); break;
+    default: putc(*s, stream);
+    }
+  }
+}
+
+
+/* mergeindex_save -- write an index file, via a temporary file */
+int mergeindex_save(const mergeindex *ix, const char *path)
+{
+  char *tmp;
+  mergeentry *e;
+  FILE *stream;
+  int fd, ok, err;
+  long i;
+
+  if (!(tmp = malloc(strlen(path) + 8))) return -1;
+  sprintf(tmp, "%s.XXXXXX", path);
+  if ((fd = mkstemp(tmp)) < 0) {err = errno; free(tmp); errno = err; return -1;}
+  if (!(stream = fdopen(fd, "w"))) {
+    err = errno;
+    close(fd);
+    unlink(tmp);
+    free(tmp);
+    errno = err;
+    return -1;
+  }
+
+  fprintf(stream, "%s\nO\t%lu\t%ld\t%lu\n", MAGIC, ix->outsize, ix->outmtime,
+	  ix->outino);
+  for (i = 0; i < ix->ninputs; i++) {
+    fprintf(stream, "I\t%ld\t%lu\t%016llx", ix->inputs[i].mtime,
+	    ix->inputs[i].size, ix->inputs[i].hash);
+    put_escaped(stream, ix->inputs[i].path);
+    putc('\n', stream);
+  }
+  for (i = 0; i < ix->records.n; i++) {
+    e = &ix->records.items[i];
+    fprintf(stream, "R\t%c\t%lu\t%lu", e->kind, e->offset, e->length);
+    put_escaped(stream, e->uid);
+    put_escaped(stream, e->rid);
+    putc('\n', stream);
+  }
+  for (i = 0; i < ix->keys.n; i++) {
+    e = &ix->keys.items[i];
+    fprintf(stream, "K\t%d\t%c", e->input, e->kind);
+    put_escaped(stream, e->uid);
+    put_escaped(stream, e->rid);
+    putc('\n', stream);
+  }
+
+  ok = !ferror(stream);
+  err = errno;
+  if (fclose(stream) != 0 && ok) {ok = 0; err = errno;}
+  if (ok && rename(tmp, path) != 0) {ok = 0; err = errno;}
+  if (!ok) unlink(tmp);
+  free(tmp);
+  errno = err;
+  return ok ? 0 : -1;
+}
+
+
+/* mergeindex_hash_file -- FNV-1a hash of the contents of a file */
+int mergeindex_hash_file(const char *path, unsigned long long *hash)
+{
+  unsigned long long h = 14695981039346656037ULL;
+  char buf[65536];
+  ssize_t n, i;
+  int fd, err;
+
+  if ((fd = open(path, O_RDONLY)) < 0) return -1;
+  while ((n = read(fd, buf, sizeof(buf))) != 0) {
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0) {err = errno; close(fd); errno = err; return -1;}
+    for (i = 0; i < n; i++) h = (h ^ (unsigned char)buf[i]) * 1099511628211ULL;
+  }
+  *hash = h;
+  return close(fd);
+}
+
+
+/* mergeindex_free_list -- free the entries of a list */
+void mergeindex_free_list(mergelist *l)
+{
+  long i;
+
+  for (i = 0; i < l->n; i++) free(l->items[i].uid);
+  free(l->items);
+  memset(l, 0, sizeof(*l));
+}
+
+
+/* mergeindex_free -- free all memory of the index */
+void mergeindex_free(mergeindex *ix)
+{
+  int i;
+
+  for (i = 0; i < ix->ninputs; i++) free(ix->inputs[i].path);
+  free(ix->inputs);
+  mergeindex_free_list(&ix->records);
+  mergeindex_free_list(&ix->keys);
+  mergeindex_init(ix);
+}
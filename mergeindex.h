@@ -0,0 +1,85 @@
+/*
+ * mergeindex -- what icalmerge wrote last time, for incremental merges
+ *
+ * The index is kept in a text file next to the merged output. It
+ * lists the inputs (with their modification time, size and a hash of
+ * their contents), the components of the output (with their byte
+ * range in it) and the keys of the components of every input. A key
+ * is a kind ('Z' for a VTIMEZONE, 'E' for a VEVENT), a UID (or TZID)
+ * and a RECURRENCE-ID ("" if none).
+ *
+ * Created: 16 Oct 2026
+ */
+
+#ifndef MERGEINDEX_H
+#define MERGEINDEX_H
+
+#include <stddef.h>
+
+/* An input file */
+typedef struct _mergeinput {
+  char *path;
+  long mtime;
+  unsigned long size;
+  unsigned long long hash;	/* FNV-1a of the contents */
+} mergeinput;
+
+/* A component in the output or in an input */
+typedef struct _mergeentry {
+  int input;			/* Input it is in, -1 for the output */
+  char kind;			/* 'Z' or 'E' */
+  unsigned long offset, length;	/* Byte range in the output */
+  char *uid, *rid;
+} mergeentry;
+
+/* A growing list of entries */
+typedef struct _mergelist {
+  mergeentry *items;
+  long n, size;
+} mergelist;
+
+typedef struct _mergeindex {
+  unsigned long outsize;	/* The output the index describes */
+  long outmtime;
+  unsigned long outino;
+  mergeinput *inputs;
+  int ninputs;
+  mergelist records;		/* Components of the output, in order */
+  mergelist keys;		/* Components of the inputs, by input */
+} mergeindex;
+
+/* mergeindex_init -- make an empty index */
+extern void mergeindex_init(mergeindex *ix);
+
+/* mergeindex_load -- read an index file
+ *
+ * Returns 0, or -1 if the file doesn't exist or isn't a valid index,
+ * in which case ix is empty. */
+extern int mergeindex_load(mergeindex *ix, const char *path);
+
+/* mergeindex_save -- write an index file, via a temporary file
+ *
+ * Returns 0, or -1 with errno set. */
+extern int mergeindex_save(const mergeindex *ix, const char *path);
+
+/* mergeindex_add_input -- add an input file, returns 0 or -1 */
+extern int mergeindex_add_input(mergeindex *ix, const char *path, long mtime,
+				unsigned long size, unsigned long long hash);
+
+/* mergeindex_add -- add a copy of an entry to a list, returns 0 or -1 */
+extern int mergeindex_add(mergelist *l, int input, char kind,
+			  unsigned long offset, unsigned long length,
+			  const char *uid, const char *rid);
+
+/* mergeindex_hash_file -- FNV-1a hash of the contents of a file
+ *
+ * Returns 0, or -1 with errno set. */
+extern int mergeindex_hash_file(const char *path, unsigned long long *hash);
+
+/* mergeindex_free_list -- free the entries of a list */
+extern void mergeindex_free_list(mergelist *l);
+
+/* mergeindex_free -- free all memory of the index */
+extern void mergeindex_free(mergeindex *ix);
+
+#endif /* MERGEINDEX_H */
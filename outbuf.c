@@ -0,0 +1,141 @@
+/*
+ * outbuf -- buffered output to a file descriptor
+ *
+ * Created: 16 Oct 2026
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <ctype.h>
+#include "outbuf.h"
+
+
+/* write_all -- write n bytes to ob->fd, remember the first error */
+static void write_all(outbuf *ob, const char *s, size_t n)
+{
+  ssize_t k;
+
+  while (n > 0 && !ob->error) {
+    k = write(ob->fd, s, n);
+    if (k < 0 && errno == EINTR) continue;
+    if (k < 0) {ob->error = errno; break;}
+    s += k;
+    n -= k;
+    ob->written += k;
+  }
+}
+
+
+/* outbuf_init -- initialize ob to write to file descriptor fd */
+void outbuf_init(outbuf *ob, int fd)
+{
+  ob->fd = fd;
+  ob->error = 0;
+  ob->len = 0;
+  ob->written = 0;
+}
+
+
+/* outbuf_flush -- write buffered bytes, return 0 or -1 (errno set) */
+int outbuf_flush(outbuf *ob)
+{
+  write_all(ob, ob->buf, ob->len);
+  ob->len = 0;
+  if (ob->error) {errno = ob->error; return -1;}
+  return 0;
+}
+
+
+/* outbuf_write -- append n bytes from s */
+void outbuf_write(outbuf *ob, const char *s, size_t n)
+{
+  if (ob->len + n > OUTBUF_SIZE) {
+    outbuf_flush(ob);
+    if (n >= OUTBUF_SIZE) {write_all(ob, s, n); return;} /* Don't copy */
+  }
+  memcpy(ob->buf + ob->len, s, n);
+  ob->len += n;
+}
+
+
+/* outbuf_puts -- append a string */
+void outbuf_puts(outbuf *ob, const char *s)
+{
+  outbuf_write(ob, s, strlen(s));
+}
+
+
+/* outbuf_printf -- append formatted text */
+void outbuf_printf(outbuf *ob, const char *format,...)
+{
+  va_list args;
+  char *s;
+  int n;
+
+  /* Try to format directly into the free part of the buffer */
+  va_start(args, format);
+  n = vsnprintf(ob->buf + ob->len, OUTBUF_SIZE - ob->len, format, args);
+  va_end(args);
+  if (n < 0) return;
+  if (ob->len + n < OUTBUF_SIZE) {ob->len += n; return;}
+
+  /* Didn't fit. Flush and try again, or use a temporary if it's huge */
+  outbuf_flush(ob);
+  va_start(args, format);
+  if (n < OUTBUF_SIZE) {
+    vsnprintf(ob->buf, OUTBUF_SIZE, format, args);
+    ob->len = n;
+  } else if ((s = malloc(n + 1))) {
+    vsnprintf(s, n + 1, format, args);
+    write_all(ob, s, n);
+    free(s);
+  } else if (!ob->error) {
+    ob->error = ENOMEM;
+  }
+  va_end(args);
+}
+
+
+/* outbuf_escaped -- append a string with <, > and & escaped */
+void outbuf_escaped(outbuf *ob, const char *s)
+{
+  size_t n;
+
+  for (;;) {
+    n = strcspn(s, "<>&");	/* Copy runs of ordinary characters at once */
+    if (n) outbuf_write(ob, s, n);
+    s += n;
+    switch (*s) {
+    case '<': outbuf_write(ob, "&lt;", 4); break;
+    case '>': outbuf_write(ob, "&gt;", 4); break;
+    case '&': outbuf_write(ob, "&amp;", 5); break;
+    default: return;		/* End of string */
+    }
+    s++;
+  }
+}
+
+
+/* outbuf_one_word -- append a string with non-alphanumerics as dashes */
+void outbuf_one_word(outbuf *ob, const char *s)
+{
+  size_t i, k, n = strlen(s);
+  char *t;
+
+  /* Convert straight into the buffer, a buffer-full at a time */
+  while (n > 0) {
+    if (ob->len == OUTBUF_SIZE) outbuf_flush(ob);
+    k = OUTBUF_SIZE - ob->len;
+    if (k > n) k = n;
+    for (t = ob->buf + ob->len, i = 0; i < k; i++)
+      t[i] = isalnum((unsigned char)s[i]) ? s[i] : '-';
+    ob->len += k;
+    s += k;
+    n -= k;
+  }
+}
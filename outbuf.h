@@ -0,0 +1,50 @@
+/*
+ * outbuf -- buffered output to a file descriptor
+ *
+ * Collects output in a large buffer and passes it to write() in big
+ * chunks, bypassing stdio. Also knows how to escape HTML text in bulk.
+ *
+ * Created: 16 Oct 2026
+ */
+
+#ifndef OUTBUF_H
+#define OUTBUF_H
+
+#include <stddef.h>
+
+#define OUTBUF_SIZE 65536	/* Bytes collected before calling write() */
+
+typedef struct _outbuf {
+  int fd;			/* File descriptor to write to */
+  int error;			/* errno of first failed write(), or 0 */
+  size_t len;			/* Number of bytes waiting in buf */
+  unsigned long written;	/* Total number of bytes written so far */
+  char buf[OUTBUF_SIZE];
+} outbuf;
+
+/* outbuf_init -- initialize ob to write to file descriptor fd */
+extern void outbuf_init(outbuf *ob, int fd);
+
+/* outbuf_write -- append n bytes from s */
+extern void outbuf_write(outbuf *ob, const char *s, size_t n);
+
+/* outbuf_puts -- append a string */
+extern void outbuf_puts(outbuf *ob, const char *s);
+
+/* outbuf_printf -- append formatted text */
+extern void outbuf_printf(outbuf *ob, const char *format,...)
+#ifdef __GNUC__
+  __attribute__((format(printf, 2, 3)))
+#endif
+  ;
+
+/* outbuf_escaped -- append a string with <, > and & escaped */
+extern void outbuf_escaped(outbuf *ob, const char *s);
+
+/* outbuf_one_word -- append a string with non-alphanumerics as dashes */
+extern void outbuf_one_word(outbuf *ob, const char *s);
+
+/* outbuf_flush -- write buffered bytes, return 0 or -1 (errno set) */
+extern int outbuf_flush(outbuf *ob);
+
+#endif /* OUTBUF_H */
@@ -0,0 +1,186 @@
+/*
+ * stats -- time the phases of a run and count what it did
+ *
+ * Created: 16 Oct 2026
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include "stats.h"
+
+#define REPORT_MAX 8192		/* Longest report, the rest is cut off */
+
+
+/* now -- the wall clock and the CPU time of the process so far */
+static void now(double *wall, double *cpu)
+{
+  struct timeval t;
+  struct rusage ru;
+
+  gettimeofday(&t, NULL);
+  *wall = t.tv_sec + t.tv_usec / 1e6;
+  getrusage(RUSAGE_SELF, &ru);
+  *cpu = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6
+    + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+
+/* stats_format_from_string -- "text" (or NULL) or "json", -1 otherwise */
+int stats_format_from_string(const char *s)
+{
+  if (!s || strcmp(s, "text") == 0) return STATS_TEXT;
+  if (strcmp(s, "json") == 0) return STATS_JSON;
+  return -1;
+}
+
+
+/* stats_init -- start with no phases and no counters */
+void stats_init(stats *s, const char *program, stats_format format)
+{
+  memset(s, 0, sizeof(*s));
+  s->format = format;
+  s->program = program;
+  s->current = -1;
+}
+
+
+/* stats_label -- say what the run is for, e.g., the output file */
+void stats_label(stats *s, const char *label)
+{
+  snprintf(s->label, sizeof(s->label), "%s", label);
+}
+
+
+/* stats_phase -- end the current phase and start the named one */
+void stats_phase(stats *s, const char *name)
+{
+  double wall, cpu;
+  int i;
+
+  if (s->format == STATS_OFF) return;
+  now(&wall, &cpu);
+  if (s->current >= 0) {
+    s->phases[s->current].wall += wall - s->wall0;
+    s->phases[s->current].cpu += cpu - s->cpu0;
+    s->current = -1;
+  }
+  if (!name) return;
+
+  for (i = 0; i < s->nphases && strcmp(s->phases[i].name, name) != 0; i++) ;
+  if (i == STATS_MAX) return;	/* Too many, ignore it */
+  if (i == s->nphases) {
+    s->phases[i].name = name;
+    s->phases[i].wall = s->phases[i].cpu = 0.0;
+    s->nphases++;
+  }
+  s->current = i;
+  s->wall0 = wall;
+  s->cpu0 = cpu;
+}
+
+
+/* stats_add -- add n to a counter, name must be a constant string */
+void stats_add(stats *s, const char *name, unsigned long n)
+{
+  int i;
+
+  if (s->format == STATS_OFF) return;
+  for (i = 0; i < s->ncounters && strcmp(s->counters[i].name, name) != 0; i++);
+  if (i == STATS_MAX) return;	/* Too many, ignore it */
+  if (i == s->ncounters) {
+    s->counters[i].name = name;
+    s->counters[i].value = 0;
+    s->ncounters++;
+  }
+  s->counters[i].value += n;
+}
+
+
+/* put -- append formatted text to buf, which has room for size bytes */
+static void put(char *buf, size_t *len, size_t size, const char *fmt, ...)
+{
+  va_list args;
+  int n;
+
+  if (*len >= size - 1) return;
+  va_start(args, fmt);
+  n = vsnprintf(buf + *len, size - *len, fmt, args);
+  va_end(args);
+  if (n > 0) *len += (size_t)n < size - *len ? (size_t)n : size - 1 - *len;
+}
+
+
+/* put_json_string -- append s as a JSON string */
+static void put_json_string(char *buf, size_t *len, size_t size,
+			    const char *s)
+{
+  put(buf, len, size, "\"");
+  for (; *s; s++)
+    if (*s == '"' || *s == '\\') put(buf, len, size, "\\%c", *s);
+    else if ((unsigned char)*s < ' ') put(buf, len, size, "\\u%04x", *s);
+    else put(buf, len, size, "%c", *s);
+  put(buf, len, size, "\"");
+}
+
+
+/* stats_report -- end the current phase and print everything to f
+ *
+ * The report is formatted first and then written with a single
+ * write(), so reports of processes that share f don't interleave. */
+void stats_report(stats *s, FILE *f)
+{
+  char buf[REPORT_MAX], who[sizeof(s->label) + 64];
+  struct rusage ru;
+  size_t len = 0, done;
+  ssize_t n;
+  long rss;
+  int i;
+
+  if (s->format == STATS_OFF) return;
+  stats_phase(s, NULL);
+  rss = getrusage(RUSAGE_SELF, &ru) == 0 ? ru.ru_maxrss : 0;
+
+  if (s->format == STATS_JSON) {
+    put(buf, &len, sizeof(buf), "{\"program\":\"%s\",", s->program);
+    if (*s->label) {
+      put(buf, &len, sizeof(buf), "\"label\":");
+      put_json_string(buf, &len, sizeof(buf), s->label);
+      put(buf, &len, sizeof(buf), ",");
+    }
+    put(buf, &len, sizeof(buf), "\"phases\":{");
+    for (i = 0; i < s->nphases; i++)
+      put(buf, &len, sizeof(buf),
+	  "%s\"%s\":{\"wall_s\":%.6f,\"cpu_s\":%.6f}", i ? "," : "",
+	  s->phases[i].name, s->phases[i].wall, s->phases[i].cpu);
+    put(buf, &len, sizeof(buf), "},\"counters\":{");
+    for (i = 0; i < s->ncounters; i++)
+      put(buf, &len, sizeof(buf), "%s\"%s\":%lu", i ? "," : "",
+	  s->counters[i].name, s->counters[i].value);
+    put(buf, &len, sizeof(buf), "},\"peak_rss_kb\":%ld}\n", rss);
+  } else {
+    if (*s->label) snprintf(who, sizeof(who), "%s %s", s->program, s->label);
+    else snprintf(who, sizeof(who), "%s", s->program);
+    for (i = 0; i < s->nphases; i++)
+      put(buf, &len, sizeof(buf), "%s: %-20s %10.6f s wall %10.6f s cpu\n",
+	  who, s->phases[i].name, s->phases[i].wall, s->phases[i].cpu);
+    for (i = 0; i < s->ncounters; i++)
+      put(buf, &len, sizeof(buf), "%s: %-20s %10lu\n", who,
+	  s->counters[i].name, s->counters[i].value);
+    put(buf, &len, sizeof(buf), "%s: %-20s %10ld\n", who, "peak_rss_kb",
+	rss);
+  }
+
+  /* What was printed to f before goes first */
+  fflush(f);
+  for (done = 0; done < len; done += n)
+    if ((n = write(fileno(f), buf + done, len - done)) < 0) {
+      if (errno == EINTR) n = 0;
+      else break;
+    }
+}
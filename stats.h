@@ -0,0 +1,70 @@
+/*
+ * stats -- time the phases of a run and count what it did
+ *
+ * A program marks the start of each phase with stats_phase(), adds to
+ * named counters with stats_add() and calls stats_report() at the
+ * end, which prints the wall clock and CPU time of every phase, the
+ * counters and the peak resident set size. When the format is
+ * STATS_OFF, all of these do nothing.
+ *
+ * When several processes report to the same stream, stats_label()
+ * tells their reports apart, and each report is written at once, so
+ * that they don't interleave.
+ *
+ * Created: 16 Oct 2026
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+
+#define STATS_MAX 24		/* Max. number of phases and of counters */
+
+typedef enum {
+  STATS_OFF,
+  STATS_TEXT,			/* One "name value" line per item */
+  STATS_JSON			/* One JSON object */
+} stats_format;
+
+typedef struct _stats {
+  stats_format format;
+  const char *program;
+  char label[256];		/* What the run was for, "" if not set */
+  struct {
+    const char *name;
+    double wall, cpu;		/* Seconds */
+  } phases[STATS_MAX];
+  struct {
+    const char *name;
+    unsigned long value;
+  } counters[STATS_MAX];
+  int nphases, ncounters;
+  int current;			/* Phase being timed, or -1 */
+  double wall0, cpu0;		/* When it started */
+} stats;
+
+/* stats_format_from_string -- "text" (or NULL) or "json", -1 otherwise */
+extern int stats_format_from_string(const char *s);
+
+/* stats_init -- start with no phases and no counters */
+extern void stats_init(stats *s, const char *program, stats_format format);
+
+/* stats_label -- say what the run is for, e.g., the output file
+ *
+ * The label is copied, and cut short if it is very long. */
+extern void stats_label(stats *s, const char *label);
+
+/* stats_phase -- end the current phase and start the named one
+ *
+ * Time spent in a phase that was timed before is added to it. A NULL
+ * name only ends the current phase. name must be a constant string. */
+extern void stats_phase(stats *s, const char *name);
+
+/* stats_add -- add n to a counter, name must be a constant string */
+extern void stats_add(stats *s, const char *name, unsigned long n);
+
+/* stats_report -- end the current phase and print everything to f */
+extern void stats_report(stats *s, FILE *f);
+
+#endif /* STATS_H */
@@ -0,0 +1,57 @@
+#!/bin/sh
+#
+# test-incremental.sh -- check that icalmerge -i writes what a full merge does
+#
+# Run by "make check" in the build directory. Generates calendars with
+# icalgen that share UIDs, time zones and overrides, then adds, changes
+# and removes events in them. After each step the output of an
+# incremental merge must be the same as that of a merge from scratch.
+#
+#   TEST_DIR  directory for the generated files (test.tmp)
+#
+# Created: 16 Oct 2026
+
+set -e
+
+DIR=${TEST_DIR:-test.tmp}
+
+rm -rf "$DIR"
+mkdir -p "$DIR"
+
+# The same seed for a and b, so b has newer versions of a's events
+./icalgen -n 300 -r 0.3 -o 0.3 -z 2 -s 1 "$DIR/a.ics"
+./icalgen -n 300 -r 0.3 -o 0.3 -z 2 -s 1 -u 0.2 "$DIR/b.ics"
+./icalgen -n 200 -r 0.3 -o 0.3 -z 3 -s 2 "$DIR/c.ics"
+
+# gen -- make an input again, with a newer modification time
+gen() {
+  f=$1
+  shift
+  sleep 1
+  ./icalgen "$@" "$DIR/$f.ics"
+}
+
+# check -- merge both ways and compare
+check() {
+  ./icalmerge -i "$DIR/a.ics" "$DIR/b.ics" "$DIR/c.ics" "$DIR/inc.ics"
+  ./icalmerge "$DIR/a.ics" "$DIR/b.ics" "$DIR/c.ics" "$DIR/full.ics"
+  if ! cmp -s "$DIR/inc.ics" "$DIR/full.ics"; then
+    echo "icalmerge -i differs from a full merge after $1" >&2
+    exit 1
+  fi
+}
+
+check "the first run"
+check "a run without changes"
+
+gen b -n 300 -r 0.3 -o 0.3 -z 2 -s 1 -u 0.5
+check "changing events"
+
+gen c -n 400 -r 0.3 -o 0.3 -z 3 -s 2
+check "adding events"
+
+gen a -n 100 -r 0.3 -o 0.3 -z 1 -s 1
+check "removing events and a time zone"
+
+gen c -n 400 -r 0.3 -o 0.3 -z 4 -s 3
+check "changing every event of an input"
@@ -0,0 +1,219 @@
+/*
+ * tzcache -- fast time zone conversions within a period
+ *
+ * The offsets are found by asking libical for the offset once a day
+ * and, where it changed, bisecting to the second it changed. Offsets
+ * change at most twice a year in practice, and never twice in a day.
+ *
+ * Created: 16 Oct 2026
+ */
+
+#include "config.h"
+#include <stdlib.h>
+#include <libical/ical.h>
+#include "eventq.h"
+#include "tzcache.h"
+
+#define DAY 86400LL
+#define MARGIN (2 * DAY)	/* Offsets are less than a day */
+
+
+/* tzcache_init -- make an empty cache for the period from start to end */
+void tzcache_init(tzcache *c, const struct icaltimetype start,
+		  const struct icaltimetype end, const icaltimezone *floating)
+{
+  icaltimezone *utc = icaltimezone_get_utc_timezone();
+
+  c->lo = eventq_time_key(icaltime_convert_to_zone(start, utc)) - MARGIN;
+  c->hi = eventq_time_key(icaltime_convert_to_zone(end, utc)) + MARGIN;
+  c->floating = floating;
+  c->zones = NULL;
+  c->n = c->size = 0;
+}
+
+
+/* find -- the offsets of zone, or NULL if it wasn't added */
+static const tzcache_zone *find(const tzcache *c, const icaltimezone *zone)
+{
+  int i;
+
+  for (i = 0; i < c->n; i++)
+    if (c->zones[i].zone == zone) return &c->zones[i];
+  return NULL;
+}
+
+
+/* offset_at -- libical's offset of zone at the instant key */
+static int offset_at(const icaltimezone *zone, long long key)
+{
+  struct icaltimetype t = eventq_key_time(key);
+  int is_daylight;
+
+  return icaltimezone_get_utc_offset_of_utc_time((icaltimezone *)zone, &t,
+						 &is_daylight);
+}
+
+
+/* add_offset -- append an offset that starts at key, return 0 or -1 */
+static int add_offset(tzcache_zone *z, int *size, long long key, int offset)
+{
+  long long *starts;
+  int *offsets;
+
+  if (z->n == *size) {
+    *size = 2 * *size + 4;
+    if (!(starts = realloc(z->starts, *size * sizeof(*starts)))) return -1;
+    z->starts = starts;
+    if (!(offsets = realloc(z->offsets, *size * sizeof(*offsets)))) return -1;
+    z->offsets = offsets;
+  }
+  z->starts[z->n] = key;
+  z->offsets[z->n++] = offset;
+  return 0;
+}
+
+
+/* tzcache_add -- look up the offsets of zone, if not done yet */
+int tzcache_add(tzcache *c, const icaltimezone *zone)
+{
+  tzcache_zone *z;
+  long long t, next, a, b, m;
+  int size = 0, offset, o;
+
+  if (!zone || zone == icaltimezone_get_utc_timezone() || find(c, zone))
+    return 0;
+  if (c->n == c->size) {
+    if (!(z = realloc(c->zones, (2 * c->size + 4) * sizeof(*z)))) return -1;
+    c->zones = z;
+    c->size = 2 * c->size + 4;
+  }
+  z = &c->zones[c->n];
+  z->zone = zone;
+  z->starts = NULL;
+  z->offsets = NULL;
+  z->n = 0;
+
+  offset = offset_at(zone, c->lo);
+  if (add_offset(z, &size, c->lo, offset) != 0) goto fail;
+  for (t = c->lo; t < c->hi; ) {
+    next = t + DAY < c->hi ? t + DAY : c->hi;
+    if ((o = offset_at(zone, next)) == offset) {t = next; continue;}
+
+    /* Find the first second with another offset */
+    for (a = t, b = next; b - a > 1; ) {
+      m = a + (b - a) / 2;
+      if (offset_at(zone, m) == offset) a = m; else b = m;
+    }
+    offset = b == next ? o : offset_at(zone, b);
+    if (add_offset(z, &size, b, offset) != 0) goto fail;
+    t = b;
+  }
+  c->n++;
+  return 0;
+
+ fail:
+  free(z->starts);
+  free(z->offsets);
+  return -1;
+}
+
+
+/* offset_of -- index of the offset in effect at the instant key */
+static int offset_of(const tzcache_zone *z, long long key)
+{
+  int lo = 0, hi = z->n - 1, mid;
+
+  /* The last offset that starts at or before key */
+  while (lo < hi) {
+    mid = lo + (hi - lo + 1) / 2;
+    if (z->starts[mid] <= key) lo = mid; else hi = mid - 1;
+  }
+  return lo;
+}
+
+
+/* local_to_utc -- key of local time t in zone z, or EVENTQ_NULL_KEY
+ *
+ * EVENTQ_NULL_KEY if t is too close to the ends of the period, or if
+ * it is skipped or repeated when the offset changes. */
+static long long local_to_utc(const tzcache *c, const tzcache_zone *z,
+			      const struct icaltimetype t)
+{
+  long long local = eventq_time_key(t);
+  int lo = 0, hi = z->n - 1, mid;
+
+  if (local < c->lo + DAY || local > c->hi - DAY) return EVENTQ_NULL_KEY;
+
+  /* The last offset whose local start is at or before t */
+  while (lo < hi) {
+    mid = lo + (hi - lo + 1) / 2;
+    if (z->starts[mid] + z->offsets[mid] <= local) lo = mid; else hi = mid - 1;
+  }
+  if (lo + 1 < z->n && local >= z->starts[lo+1] + z->offsets[lo])
+    return EVENTQ_NULL_KEY;	/* Skipped */
+  if (lo > 0 && local < z->starts[lo] + z->offsets[lo-1])
+    return EVENTQ_NULL_KEY;	/* Repeated */
+  return local - z->offsets[lo];
+}
+
+
+/* tzcache_utc_key -- eventq_time_key() of t converted to UTC */
+long long tzcache_utc_key(const tzcache *c, struct icaltimetype t)
+{
+  icaltimezone *utc = icaltimezone_get_utc_timezone();
+  const tzcache_zone *z;
+  long long key;
+
+  /* A floating time is a local time of the floating zone */
+  if (icaltime_is_null_time(t)) return EVENTQ_NULL_KEY;
+  if (!t.is_date && !t.zone && !t.is_utc) t.zone = c->floating;
+  if (t.is_date || !t.zone || t.zone == utc) return eventq_time_key(t);
+  if ((z = find(c, t.zone))
+      && (key = local_to_utc(c, z, t)) != EVENTQ_NULL_KEY)
+    return key;
+  return eventq_time_key(icaltime_convert_to_zone(t, utc));
+}
+
+
+/* tzcache_convert -- like icaltime_convert_to_zone(t, zone) */
+struct icaltimetype tzcache_convert(const tzcache *c,
+				    const struct icaltimetype t,
+				    long long key, icaltimezone *zone)
+{
+  icaltimezone *utc = icaltimezone_get_utc_timezone();
+  struct icaltimetype r, local;
+  const tzcache_zone *z = NULL;
+
+  /* What icaltime_convert_to_zone() doesn't convert, or we can't */
+  if (t.is_date || !t.zone || t.zone == zone || !zone
+      || icaltime_is_null_time(t) || key < c->lo || key > c->hi
+      || (zone != utc && !(z = find(c, zone))))
+    return icaltime_convert_to_zone(t, zone);
+
+  local = eventq_key_time(z ? key + z->offsets[offset_of(z, key)] : key);
+  r = t;
+  r.year = local.year;
+  r.month = local.month;
+  r.day = local.day;
+  r.hour = local.hour;
+  r.minute = local.minute;
+  r.second = local.second;
+  r.zone = zone;
+  r.is_utc = zone == utc;
+  return r;
+}
+
+
+/* tzcache_free -- free the memory used by the cache */
+void tzcache_free(tzcache *c)
+{
+  int i;
+
+  for (i = 0; i < c->n; i++) {
+    free(c->zones[i].starts);
+    free(c->zones[i].offsets);
+  }
+  free(c->zones);
+  c->zones = NULL;
+  c->n = c->size = 0;
+}
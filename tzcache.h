@@ -0,0 +1,66 @@
+/*
+ * tzcache -- fast time zone conversions within a period
+ *
+ * For each time zone that is added, the UTC offsets and the instants
+ * they start at are looked up once, over the period plus a margin.
+ * Converting a time in the period is then a binary search over them
+ * instead of a walk through libical's observances. Times outside the
+ * period, in zones that weren't added, or local times that are skipped
+ * or repeated at a change of offset are converted by libical.
+ *
+ * Created: 16 Oct 2026
+ */
+
+#ifndef TZCACHE_H
+#define TZCACHE_H
+
+#include <libical/ical.h>
+
+/* The offsets of one zone */
+typedef struct _tzcache_zone {
+  const icaltimezone *zone;
+  long long *starts;		/* Key of the instant each offset starts */
+  int *offsets;			/* Seconds east of UTC */
+  int n;
+} tzcache_zone;
+
+typedef struct _tzcache {
+  long long lo, hi;		/* Keys of the first and last instant */
+  const icaltimezone *floating;	/* Zone of floating times, or NULL */
+  tzcache_zone *zones;
+  int n, size;
+} tzcache;
+
+/* tzcache_init -- make an empty cache for the period from start to end
+ *
+ * Floating times are taken to be in zone floating, unless it is NULL.
+ * Add that zone with tzcache_add() as well. */
+extern void tzcache_init(tzcache *c, const struct icaltimetype start,
+			 const struct icaltimetype end,
+			 const icaltimezone *floating);
+
+/* tzcache_add -- look up the offsets of zone, if not done yet
+ *
+ * Returns 0, or -1 if out of memory. Uses libical, so call it from the
+ * main thread only, and not while other threads use the cache. */
+extern int tzcache_add(tzcache *c, const icaltimezone *zone);
+
+/* tzcache_utc_key -- eventq_time_key() of t converted to UTC
+ *
+ * Like icaltime_convert_to_zone(), dates are not converted. Floating
+ * times are converted from the floating zone given to tzcache_init(),
+ * so that they sort and print as the local times of that zone. */
+extern long long tzcache_utc_key(const tzcache *c,
+				 const struct icaltimetype t);
+
+/* tzcache_convert -- like icaltime_convert_to_zone(t, zone)
+ *
+ * key must be tzcache_utc_key(c, t). */
+extern struct icaltimetype tzcache_convert(const tzcache *c,
+					   const struct icaltimetype t,
+					   long long key, icaltimezone *zone);
+
+/* tzcache_free -- free the memory used by the cache */
+extern void tzcache_free(tzcache *c);
+
+#endif /* TZCACHE_H */
@@ -0,0 +1,127 @@
+/*
+ * uidindex -- hash index of events by UID and RECURRENCE-ID
+ *
+ * Created: 16 Oct 2026
+ */
+
+#include "config.h"
+#include <stdlib.h>
+#include <string.h>
+#include "uidindex.h"
+
+#define MIN_SIZE 1024		/* Initial number of slots */
+
+
+/* hash -- FNV-1a hash of uid and rid */
+static unsigned long hash(const char *uid, const char *rid)
+{
+  unsigned long h = 2166136261UL;
+
+  for (; *uid; uid++) h = (h ^ (unsigned char)*uid) * 16777619UL;
+  h *= 16777619UL;		/* The '\0' between them */
+  for (; *rid; rid++) h = (h ^ (unsigned char)*rid) * 16777619UL;
+  return h;
+}
+
+
+/* grow -- double the number of slots and move the entries */
+static int grow(uidindex *ix)
+{
+  uidindex_slot *old = ix->slots;
+  size_t i, j, oldsize = ix->size, size = oldsize ? 2 * oldsize : MIN_SIZE;
+
+  if (!(ix->slots = calloc(size, sizeof(*ix->slots)))) {
+    ix->slots = old;
+    return -1;
+  }
+  ix->size = size;
+  for (i = 0; i < oldsize; i++) {
+    if (!old[i].key) continue;
+    for (j = old[i].hash & (size - 1); ix->slots[j].key; j = (j + 1) & (size-1));
+    ix->slots[j] = old[i];
+  }
+  free(old);
+  return 0;
+}
+
+
+/* intern -- copy the key into the key store, return its offset or 0 */
+static size_t intern(uidindex *ix, const char *uid, const char *rid)
+{
+  size_t ulen = strlen(uid) + 1, rlen = strlen(rid) + 1, key;
+  char *keys;
+
+  if (ix->keylen + ulen + rlen > ix->keysize) {
+    ix->keysize = 2 * ix->keysize + ulen + rlen + 65536;
+    if (!(keys = realloc(ix->keys, ix->keysize))) return 0;
+    ix->keys = keys;
+    if (ix->keylen == 0) ix->keylen = 1; /* Offset 0 means "no key" */
+  }
+  key = ix->keylen;
+  memcpy(ix->keys + key, uid, ulen);
+  memcpy(ix->keys + key + ulen, rid, rlen);
+  ix->keylen += ulen + rlen;
+  return key;
+}
+
+
+/* uidindex_init -- make an empty index */
+void uidindex_init(uidindex *ix)
+{
+  memset(ix, 0, sizeof(*ix));
+}
+
+
+/* uidindex_find -- find (uid, rid) or add it, with value -1 */
+long *uidindex_find(uidindex *ix, const char *uid, const char *rid)
+{
+  unsigned long h = hash(uid, rid);
+  const char *k;
+  size_t i;
+
+  if (2 * (ix->n + 1) > ix->size && grow(ix) != 0) return NULL;
+
+  ix->lookups++;
+  for (i = h & (ix->size - 1); ix->slots[i].key; i = (i + 1) & (ix->size - 1)) {
+    ix->probes++;
+    if (ix->slots[i].hash != h) continue;
+    k = ix->keys + ix->slots[i].key;
+    if (strcmp(k, uid) == 0 && strcmp(k + strlen(k) + 1, rid) == 0)
+      return &ix->slots[i].value;
+  }
+
+  /* Not found, i is an empty slot */
+  if (!(ix->slots[i].key = intern(ix, uid, rid))) return NULL;
+  ix->slots[i].hash = h;
+  ix->slots[i].value = -1;
+  ix->n++;
+  return &ix->slots[i].value;
+}
+
+
+/* uidindex_get -- find (uid, rid) without adding it */
+const long *uidindex_get(const uidindex *ix, const char *uid, const char *rid)
+{
+  unsigned long h;
+  const char *k;
+  size_t i;
+
+  if (ix->n == 0) return NULL;
+  h = hash(uid, rid);
+  for (i = h & (ix->size - 1); ix->slots[i].key; i = (i + 1) & (ix->size - 1)) {
+    if (ix->slots[i].hash != h) continue;
+    k = ix->keys + ix->slots[i].key;
+    if (strcmp(k, uid) == 0 && strcmp(k + strlen(k) + 1, rid) == 0)
+      return &ix->slots[i].value;
+  }
+  return NULL;
+}
+
+
+/* uidindex_free -- free all memory of the index */
+void uidindex_free(uidindex *ix)
+{
+  free(ix->slots);
+  free(ix->keys);
+  uidindex_init(ix);
+}
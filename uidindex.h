@@ -0,0 +1,53 @@
+/*
+ * uidindex -- hash index of events by UID and RECURRENCE-ID
+ *
+ * Open addressing with linear probing, kept at most half full by
+ * doubling, so lookups stay short however many events there are. The
+ * keys are copied once into one growing block of memory ("interned")
+ * and each slot keeps the full hash, so most mismatches are found
+ * without touching the keys at all.
+ *
+ * Created: 16 Oct 2026
+ */
+
+#ifndef UIDINDEX_H
+#define UIDINDEX_H
+
+#include <stddef.h>
+
+typedef struct _uidindex_slot {
+  unsigned long hash;
+  size_t key;			/* Offset of the key in keys, 0 = empty */
+  long value;			/* Whatever the caller wants */
+} uidindex_slot;
+
+typedef struct _uidindex {
+  uidindex_slot *slots;
+  size_t size, n;		/* size is 0 or a power of 2 */
+  char *keys;			/* "uid\0recurrence-id\0" for every entry */
+  size_t keylen, keysize;
+  unsigned long lookups, probes; /* Statistics */
+} uidindex;
+
+/* uidindex_init -- make an empty index */
+extern void uidindex_init(uidindex *ix);
+
+/* uidindex_find -- find (uid, rid) or add it, with value -1
+ *
+ * rid is "" for events without a RECURRENCE-ID. Returns a pointer to
+ * the value, which stays valid until the next uidindex_find(), or NULL
+ * if out of memory. */
+extern long *uidindex_find(uidindex *ix, const char *uid, const char *rid);
+
+/* uidindex_get -- find (uid, rid) without adding it
+ *
+ * Returns a pointer to the value, or NULL if (uid, rid) isn't in the
+ * index. Changes nothing, not even the statistics, so several threads
+ * may look up keys at the same time. */
+extern const long *uidindex_get(const uidindex *ix, const char *uid,
+				const char *rid);
+
+/* uidindex_free -- free all memory of the index */
+extern void uidindex_free(uidindex *ix);
+
+#endif /* UIDINDEX_H */
@@ -0,0 +1,33 @@
+/*
+ * words -- split a line into words, as in batch and rules files
+ *
+ * Created: 16 Oct 2026
+ */
+
+#include "config.h"
+#include <string.h>
+#include <ctype.h>
+#include "words.h"
+
+
+/* split_words -- split a line into words, return their number or -1 */
+int split_words(char *s, char *words[], int max)
+{
+  int n = 0;
+  char *t;
+
+  for (;;) {
+    while (isspace((unsigned char)*s)) s++;
+    if (!*s) return n;
+    if (n == max) return -1;
+    if (*s == '"') {		/* Quoted word */
+      words[n++] = ++s;
+      if (!(t = strchr(s, '"'))) return -1;
+    } else {
+      words[n++] = t = s;
+      while (*t && !isspace((unsigned char)*t)) t++;
+    }
+    s = *t ? t + 1 : t;
+    *t = '\0';
+  }
+}
@@ -0,0 +1,17 @@
+/*
+ * words -- split a line into words, as in batch and rules files
+ *
+ * Created: 16 Oct 2026
+ */
+
+#ifndef WORDS_H
+#define WORDS_H
+
+/* split_words -- split a line into words, return their number or -1
+ *
+ * Words are separated by white space, a word in double quotes may
+ * contain spaces. The words point into s, which is modified. Returns
+ * -1 if there are more than max words or a quote isn't closed. */
+extern int split_words(char *s, char *words[], int max);
+
+#endif /* WORDS_H */